@@ -2,9 +2,28 @@
  * Created by Ivo Georgiev on 2/9/16.
  */
 
+#define _GNU_SOURCE // for mmap() flags, shm_open() and robust mutexes under -std=c11
+
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h> // for perror()
+#include <string.h> // for memmove()
+#include <errno.h>
+#include <stdint.h> // for uintptr_t
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h> // for mbind() and getcpu(), which glibc doesn't wrap without libnuma
+#include <time.h> // for nanosleep()
+#ifdef __SSE2__
+#include <emmintrin.h> // for _mm_stream_si128()
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MEM_GAP_SCAN_X86
+#include <immintrin.h> // for the gap index search kernels, built per function with target()
+#endif
 
 #include "mem_pool.h"
 
@@ -31,6 +50,31 @@ static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
+static const unsigned   MEM_GAP_SCAN_WINDOW             = 32;//gap index entries left to the scan kernel
+
+static const unsigned   MEM_PTR_IX_INIT_CAPACITY        = 64;
+static const float      MEM_PTR_IX_FILL_FACTOR          = 0.5;
+
+static const unsigned long MEM_MAP_MAGIC                = 0x6c6f6f704d454dUL;//"MEMpool"
+static const unsigned   MEM_MAP_VERSION                 = 15;
+static const unsigned   MEM_MAP_CAPACITY                = 4096;
+static const size_t     MEM_MAP_ALIGN                   = 64;
+static const unsigned   MEM_MAP_ATTACH_TIMEOUT_MS       = 1000;//how long an attach waits for the creator
+static const unsigned   MEM_GOOD_FIT_SLACK              = 25;//percent of the request GOOD_FIT may waste
+static const size_t     MEM_BITMAP_SLAB_RECORDS         = 256;//alloc_t records added at a time to a bitmap pool
+static const size_t     MEM_BITMAP_NO_RECORD            = (size_t) -1;//end of the free record list
+static const unsigned   MEM_NODE_DEFERRED               = 2;//node->allocated: freed, waiting in the quick list
+static const size_t     MEM_ZERO_STREAM_THRESHOLD       = 256 * 1024;//bigger than L2, bypass the cache
+static const size_t     MEM_PREFAULT_PARALLEL_MIN       = (size_t) 1 << 30;//fault bigger pools in from several threads
+static const int        MEM_MPOL_BIND                   = 2;//from linux/mempolicy.h
+static const int        MEM_MPOL_INTERLEAVE             = 3;
+static const unsigned   MEM_MPOL_MF_MOVE                = 1 << 1;
+static const unsigned   MEM_GROUP_INIT_CAPACITY         = 8;//pools a group has room for before growing
+
+// array sizes, so these can't be static const.
+#define MEM_PREFAULT_MAX_THREADS 16
+#define MEM_NUMA_MAX_NODES 1024 //node ids past this are taken to be offline
+#define MEM_NUMA_WORD_BITS (8 * sizeof(unsigned long)) //nodes per word of a node mask
 
 /*
 #define     MEM_FILL_FACTOR                   0.75
@@ -54,16 +98,47 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /* Type declarations */
 /*                   */
 /*********************/
+#ifdef MEM_POOL_COMPACT_NODES
+/*
+    Compact nodes (build with -DMEM_POOL_COMPACT_NODES):
+    16 bytes instead of 48, so four fit in a cache line. The links are offsets in the
+    node heap, which stay valid when the heap is reallocated, and the segment is a
+    32-bit offset into pool.mem and a 32-bit size, which limits a pool to 4 GiB.
+*/
+#define MEM_NODE_NIL 0x0FFFFFFFu //the NULL of a link, and the most nodes a heap can have
+typedef struct _node {
+    unsigned next : 28;
+    unsigned used : 1;
+    unsigned allocated : 2;// 1-allocation, 0-gap, MEM_NODE_DEFERRED-freed but not yet coalesced
+    unsigned zeroed : 1;// the bytes are known to be zero (never written, or zeroed on the way in)
+    unsigned prev;
+    unsigned offset;// of the segment in pool.mem
+    unsigned size;
+} node_t, *node_pt;
+#else
 typedef struct _node {
     alloc_t alloc_record;
     unsigned used;
-    unsigned allocated;
+    unsigned allocated;// 1-allocation, 0-gap, MEM_NODE_DEFERRED-freed but not yet coalesced
+    unsigned zeroed;// the bytes are known to be zero (never written, or zeroed on the way in)
     struct _node *next, *prev; // doubly-linked list for gap deletion
 } node_t, *node_pt;
+#endif
+
+/*
+    The alloc_t handed out for node i is record i, kept in slabs of MEM_RECORD_SLAB
+    that are never moved, so an alloc_pt stays valid when the node heap is reallocated.
+    The setters below keep it up to date; the list walks never read it.
+*/
+#define MEM_RECORD_SLAB 256
 
 
 typedef struct _node_head{
     node_pt _nodes;// the data store of all nodes.
+    alloc_pt *_records;// the slabs of alloc_t records, one record per node.
+#ifdef MEM_POOL_COMPACT_NODES
+    char *mem;// the pool memory node offsets are relative to.
+#endif
     node_pt begin;// the beginning node
     node_pt end;// the ending node
     size_t max_size;
@@ -82,6 +157,139 @@ typedef struct _node_head{
 
 */
 
+/*
+    Node accessors. Links and segments are only read and written through these,
+    so everything above them is the same for both node layouts.
+*/
+static alloc_pt node_record(node_head_pt head, size_t i){
+    return &head->_records[i / MEM_RECORD_SLAB][i % MEM_RECORD_SLAB];
+}
+
+static alloc_pt node_get_alloc(node_pt node, node_head_pt head){
+    return node_record(head, (size_t) (node - head->_nodes));
+}
+
+//NULL if alloc is not one of the records.
+static node_pt alloc_get_node(alloc_pt alloc, node_head_pt head){
+    size_t slabs = (head->max_size + MEM_RECORD_SLAB - 1) / MEM_RECORD_SLAB;
+    size_t s = 0;
+    while (s < slabs){
+        uintptr_t offset = (uintptr_t) alloc - (uintptr_t) head->_records[s];
+        if ((uintptr_t) alloc >= (uintptr_t) head->_records[s] && offset < sizeof(alloc_t) * MEM_RECORD_SLAB
+            && offset % sizeof(alloc_t) == 0){
+            size_t i = s * MEM_RECORD_SLAB + offset / sizeof(alloc_t);
+            return (i < head->max_size) ? &head->_nodes[i] : NULL;
+        }
+        s += 1;
+    }
+    return NULL;
+}
+
+#ifdef MEM_POOL_COMPACT_NODES
+static node_pt node_get_next(node_pt node, node_head_pt head){
+    return (node->next == MEM_NODE_NIL) ? NULL : &head->_nodes[node->next];
+}
+
+static node_pt node_get_prev(node_pt node, node_head_pt head){
+    return (node->prev == MEM_NODE_NIL) ? NULL : &head->_nodes[node->prev];
+}
+
+static void node_set_next(node_pt node, node_head_pt head, node_pt next){
+    node->next = (next == NULL) ? MEM_NODE_NIL : (unsigned) (next - head->_nodes);
+}
+
+static void node_set_prev(node_pt node, node_head_pt head, node_pt prev){
+    node->prev = (prev == NULL) ? MEM_NODE_NIL : (unsigned) (prev - head->_nodes);
+}
+
+static size_t node_get_size(node_pt node, node_head_pt head){
+    (void) head;
+    return node->size;
+}
+
+static void node_set_size(node_pt node, node_head_pt head, size_t size){
+    node->size = (unsigned) size;
+    node_get_alloc(node, head)->size = size;
+}
+
+static char *node_get_mem(node_pt node, node_head_pt head){
+    return head->mem + node->offset;
+}
+
+static void node_set_mem(node_pt node, node_head_pt head, char *mem){
+    node->offset = (mem == NULL) ? 0 : (unsigned) (mem - head->mem);
+    node_get_alloc(node, head)->mem = mem;
+}
+#else
+static node_pt node_get_next(node_pt node, node_head_pt head){
+    (void) head;
+    return node->next;
+}
+
+static node_pt node_get_prev(node_pt node, node_head_pt head){
+    (void) head;
+    return node->prev;
+}
+
+static void node_set_next(node_pt node, node_head_pt head, node_pt next){
+    (void) head;
+    node->next = next;
+}
+
+static void node_set_prev(node_pt node, node_head_pt head, node_pt prev){
+    (void) head;
+    node->prev = prev;
+}
+
+static size_t node_get_size(node_pt node, node_head_pt head){
+    (void) head;
+    return node->alloc_record.size;
+}
+
+static void node_set_size(node_pt node, node_head_pt head, size_t size){
+    node->alloc_record.size = size;
+    node_get_alloc(node, head)->size = size;
+}
+
+static char *node_get_mem(node_pt node, node_head_pt head){
+    (void) head;
+    return node->alloc_record.mem;
+}
+
+static void node_set_mem(node_pt node, node_head_pt head, char *mem){
+    node->alloc_record.mem = mem;
+    node_get_alloc(node, head)->mem = mem;
+}
+#endif
+
+//makes room for the records of number_of_nodes nodes, keeping the slabs there are.
+static char node_records_reserve(node_head_pt head, size_t number_of_nodes){
+    size_t have = (head->max_size + MEM_RECORD_SLAB - 1) / MEM_RECORD_SLAB;
+    size_t need = (number_of_nodes + MEM_RECORD_SLAB - 1) / MEM_RECORD_SLAB;
+    if (need <= have){
+        return 1;
+    }
+    alloc_pt *table = (alloc_pt*)realloc((void*)head->_records, sizeof(alloc_pt)*need);
+    if (table == NULL){
+        return 0;
+    }
+    head->_records = table;
+    while (have < need){
+        table[have] = (alloc_pt)malloc(sizeof(alloc_t)*MEM_RECORD_SLAB);
+        if (table[have] == NULL){
+            //shrink back to what max_size covers, so the slabs stay in step with it.
+            size_t keep = (head->max_size + MEM_RECORD_SLAB - 1) / MEM_RECORD_SLAB;
+            while (have > keep){
+                have -= 1;
+                free(table[have]);
+            }
+            return 0;
+        }
+        have += 1;
+    }
+    return 1;
+}
+
 
 //initializes a new node list. Beginning points to nothing. Ending points to nothing.
 //nodes are generated.
@@ -96,6 +304,19 @@ node_head_pt node_head_init( node_head_pt new_list, size_t number_of_nodes){
     {
         return NULL;
     }
+    new_list->_records = NULL;
+    new_list->max_size = 0;
+    if (!node_records_reserve(new_list, number_of_nodes))
+    {
+        free(new_list->_nodes);
+        new_list->_nodes = NULL;
+        free(new_list->_records);
+        new_list->_records = NULL;
+        return NULL;
+    }
+#ifdef MEM_POOL_COMPACT_NODES
+    new_list->mem = NULL;
+#endif
     new_list->length = 0;
     new_list->max_size = number_of_nodes;
     new_list->begin = NULL;
@@ -115,6 +336,10 @@ node_head_pt init_to_share_existing_list(node_head_pt existing_list, node_head_p
     empty_list->begin = NULL;
     empty_list->end = NULL;
     empty_list->_nodes = existing_list->_nodes;//share memory
+    empty_list->_records = existing_list->_records;
+#ifdef MEM_POOL_COMPACT_NODES
+    empty_list->mem = existing_list->mem;
+#endif
     return empty_list;
 }
 
@@ -133,8 +358,8 @@ node_pt next_node(node_pt node, node_head_pt head){
     if (node == NULL){
         return NULL;
     }else{
-        if (node->next != NULL){
-            return node->next;
+        if (node_get_next(node, head) != NULL){
+            return node_get_next(node, head);
         }
         return head->begin;
     }
@@ -145,8 +370,8 @@ node_pt prev_node(node_pt node, node_head_pt head){
     if(node == NULL){
         return NULL;
     }else{
-        if(node->prev != NULL){
-            return node->prev;
+        if(node_get_prev(node, head) != NULL){
+            return node_get_prev(node, head);
         }
         return head->end;
     }
@@ -190,29 +415,23 @@ node_pt node_list_insert(node_pt node_to_insert, node_head_pt head, node_pt inse
     }
     if (insert_after == NULL){
         ++(head->length);
-        node_to_insert->prev = NULL;
-        node_to_insert->next = head->begin;
+        node_set_prev(node_to_insert, head, NULL);
+        node_set_next(node_to_insert, head, head->begin);
         head->begin = node_to_insert;
         return head->begin;
     }
-    node_pt iter = head->begin;
-    /*This is very safe, much better performance can be gotten with a simple assignment*/
-    while( iter != NULL && iter != insert_after){
-        iter = iter->next;
-    }
-    if ( iter != NULL){
-    //you found the iterator! Yay!
-        ++(head->length);
-        node_to_insert->next = iter->next;
-        if(iter->next != NULL){
-            iter->next->prev = node_to_insert;
-        }//point the node to insert to the next element the iterator points at.
-        //if it exists point back.
-
-        node_to_insert->prev = iter;
-        //point the node to insert at the iterator, recall it is non-null in this block.
-        iter->next = node_to_insert;
-    }
+    //insert_after is trusted to be in the list, so it's linked in place without a walk.
+    node_pt iter = insert_after;
+    ++(head->length);
+    node_set_next(node_to_insert, head, node_get_next(iter, head));
+    if(node_get_next(iter, head) != NULL){
+        node_set_prev(node_get_next(iter, head), head, node_to_insert);
+    }//point the node to insert to the next element the iterator points at.
+    //if it exists point back.
+
+    node_set_prev(node_to_insert, head, iter);
+    //point the node to insert at the iterator, recall it is non-null here.
+    node_set_next(iter, head, node_to_insert);
     return iter;
 }
 
@@ -233,28 +452,28 @@ node_pt remove_node(node_pt node, node_head_pt head){
     while( iter != NULL){
         if(iter == node){
             head->length-=1;
-            if(iter->next != NULL){
-                iter->next->prev = iter->prev;
+            if(node_get_next(iter, head) != NULL){
+                node_set_prev(node_get_next(iter, head), head, node_get_prev(iter, head));
             }
-            if(iter->prev != NULL){
-                iter->prev->next = iter->next;
+            if(node_get_prev(iter, head) != NULL){
+                node_set_next(node_get_prev(iter, head), head, node_get_next(iter, head));
             }
             if(head->begin == iter){
-                head->begin = iter->next;
+                head->begin = node_get_next(iter, head);
             }
             if(head->end == iter){
-                head->end = iter->prev;
+                head->end = node_get_prev(iter, head);
             }
             /*Safety code*/
             if( head->length == 0){
                 head->end = NULL;
                 head->begin = NULL;
             }
-            iter->next = NULL;
-            iter->prev = NULL;
+            node_set_next(iter, head, NULL);
+            node_set_prev(iter, head, NULL);
             return iter;
         }//end of if statement
-        iter = iter->next;//cycle to next node, if it is null this will break.
+        iter = node_get_next(iter, head);//cycle to next node, if it is null this will break.
     }
     return NULL;//iterator not found, return null
 }
@@ -265,10 +484,44 @@ node_pt remove_node(node_pt node, node_head_pt head){
 */
 node_pt resize_node_head(node_head_pt head, size_t multiplier){
 
+    //begin and end are pointers into the array, keep them as offsets across the move.
+    ptrdiff_t begin = (head->begin == NULL) ? -1 : head->begin - head->_nodes;
+    ptrdiff_t end = (head->end == NULL) ? -1 : head->end - head->_nodes;
+#ifndef MEM_POOL_COMPACT_NODES
+    //the links are pointers too: offsets + 1 (0 is NULL) while the array moves...
+    node_pt iter = head->begin;
+    while (iter != NULL){
+        node_pt next = iter->next;
+        iter->next = (node_pt) (uintptr_t) ((next == NULL) ? 0 : next - head->_nodes + 1);
+        iter->prev = (node_pt) (uintptr_t) ((iter->prev == NULL) ? 0 : iter->prev - head->_nodes + 1);
+        iter = next;
+    }
+#endif
+    node_pt old = head->_nodes;
     node_pt res = (node_pt)realloc((void*)head->_nodes, sizeof(node_t)*(multiplier)*(head->max_size));
+    node_pt base = (res != NULL) ? res : old;//a failed realloc leaves the array where it was.
+#ifndef MEM_POOL_COMPACT_NODES
+    //...and pointers into wherever it is now.
+    iter = (begin < 0) ? NULL : &base[begin];
+    while (iter != NULL){
+        uintptr_t next = (uintptr_t) iter->next;
+        uintptr_t prev = (uintptr_t) iter->prev;
+        iter->next = (next == 0) ? NULL : &base[next - 1];
+        iter->prev = (prev == 0) ? NULL : &base[prev - 1];
+        iter = iter->next;
+    }
+#else
+    (void) base;
+#endif
 
     if(res != NULL ){
         head->_nodes = res;
+        head->begin = (begin < 0) ? NULL : &res[begin];
+        head->end = (end < 0) ? NULL : &res[end];
+        //a bigger array is harmless if the records can't follow.
+        if (!node_records_reserve(head, multiplier*head->max_size)){
+            return NULL;
+        }
         head->max_size *= multiplier;
         res = NULL;
         return head->_nodes;
@@ -277,20 +530,197 @@ node_pt resize_node_head(node_head_pt head, size_t multiplier){
     }
 }
 
-typedef struct _gap {
-    size_t size;
-    node_pt node;
-} gap_t, *gap_pt;
+/*
+    Gap index:
+    A structure of arrays, sorted by size and then address. The sizes are contiguous,
+    so a search reads 8 bytes per gap instead of a whole entry, and can compare 4 (AVX2)
+    or 2 (SSE4.2) of them per instruction. The node of each gap is kept alongside as
+    its offset in the node heap, which stays valid when the heap or the mapping moves.
+    FIRST_FIT and GOOD_FIT pick gaps by walking the list and never read it, so their
+    pools only count the gaps, and the index is rebuilt the first time it is read.
+*/
+typedef struct _gap_ix {
+    size_t *size;
+    unsigned *node;
+} gap_ix_t;
+
+// Finds the first index of a sorted size array holding a size >= size, or n.
+typedef unsigned (*gap_scan_fn)(const size_t *sizes, unsigned n, size_t size);
+
+/*
+    Pointer index:
+    An open-addressing hash table (linear probing) from the payload offset of every
+    allocation to its node. Offsets and node indices stay valid when the node heap is
+    reallocated or a mapping is moved, unlike pointers. key 0 marks an empty slot,
+    so keys are stored as offset + 1.
+*/
+typedef struct _ptr_ix {
+    size_t key;
+    size_t node;
+} ptr_ix_t, *ptr_ix_pt;
+
+#define MEM_SIZE_CLASSES_MAX 64 //room in the pool mgr, so mapped pools keep their table too
+#define MEM_QUICK_CAPACITY 256 //the most freed blocks deferred coalescing will hold back
 
 typedef struct _pool_mgr {
     pool_t pool;
     node_head_pt node_heap;//use a proper list head.
     unsigned total_nodes;//what is this?-> no reference to it in test suite...
     unsigned used_nodes;//what is this?-> no reference to it in the test suite... Means it is total number of nodes initialized ever.
-    gap_pt gap_ix;
+    unsigned free_nodes;//offset + 1 of the first unused node below used_nodes, 0 if none; chained through their size.
+    gap_ix_t gap_ix;
     unsigned gap_ix_capacity;//what is this?-> max possible capacity
+    unsigned gap_ix_stale;//only num_gaps is up to date, _mem_sync_gap_ix rebuilds the rest.
+    struct _pool_map *map;//header of the mapping this pool lives in, NULL for heap pools.
+    ptr_ix_pt ptr_ix;//payload offset -> node, for freeing by address.
+    unsigned ptr_ix_capacity;//a power of 2.
+    unsigned ptr_ix_count;
+    unsigned tagged;//boundary-tag layout: no node heap, gap index or pointer index.
+    size_t size_classes[MEM_SIZE_CLASSES_MAX];//ascending, requests are rounded up to one.
+    unsigned num_size_classes;//0: requests are served at their exact size.
+    size_t min_gap;//a remainder smaller than this stays with the allocation.
+    unsigned quick_threshold;//0: blocks are coalesced when freed.
+    unsigned quick_count;
+    unsigned quick_node[MEM_QUICK_CAPACITY];//node heap offsets of the deferred blocks, oldest first.
+    size_t quick_size[MEM_QUICK_CAPACITY];//and their sizes, scanned for an exact match.
+    pool_stats_t stats;
+    unsigned good_fit_slack;//GOOD_FIT: percent of the request a gap may exceed it by.
+    float node_heap_fill_factor;//the node heap grows once this full...
+    unsigned node_heap_expand_factor;//...to this many times its size.
+    float gap_ix_fill_factor;
+    unsigned gap_ix_expand_factor;
+    size_t granule;//bitmap layout: bytes per bit, 0 for every other layout.
+    unsigned granule_shift;//log2(granule)
+    size_t num_granules;
+    uint64_t *bitmap;//1: the granule is in use.
+    uint64_t *starts;//1: an allocation starts at the granule.
+    alloc_pt *record_slabs;//MEM_BITMAP_SLAB_RECORDS each, never moved once handed out.
+    size_t num_records;
+    size_t free_record;//head of the unused records, chained through their size.
+    mem_group_pt group;//the group that opened the pool, NULL for one opened directly.
+    unsigned group_cls;//its class there, num_classes for a dedicated pool.
 } pool_mgr_t, *pool_mgr_pt;
 
+/*
+    Boundary-tag pools:
+    The metadata lives in pool.mem itself. Every block (allocation or gap) starts with
+    a tag_t and ends with a copy of its tag word:
+        [tag: size|allocated, alloc_t record][payload ...][tag]
+    The size is that of the whole block, a multiple of 8, with bit 0 as the allocated
+    flag. The alloc_t in the header is the record handed out, so an alloc_pt never
+    moves. Neighbours are found from the block's own size (next) and from the tag word
+    just before it (previous), so freeing only touches the adjacent blocks.
+    Gaps are searched by walking the blocks in address order.
+*/
+typedef struct _tag {
+    size_t tag;
+    alloc_t record;
+} tag_t, *tag_pt;
+
+static const size_t     MEM_TAG_OVERHEAD                = sizeof(tag_t) + sizeof(size_t);
+static const size_t     MEM_TAG_MIN_BLOCK               = sizeof(tag_t) + sizeof(size_t) + 8;
+
+/*
+    Bitmap pools:
+    pool.mem is cut into granules of a power-of-2 size, and every allocation is a
+    run of whole granules. One bit per granule says whether it is in use, and a
+    second one marks where each allocation starts, so adjacent allocations can be
+    told apart. A search reads 64 granules per word: full words are skipped with a
+    single compare, and the ends of a run are found with ctz. There is no node heap
+    or gap index. The alloc_t records handed out live in slabs that are never moved,
+    and the pointer index maps each payload offset to its record.
+*/
+
+/*
+    Mapped pools (file or shared memory backed):
+    The whole pool lives in one shared mapping, laid out as
+        [pool_map_t][pool_mgr_t][node_head][nodes x capacity][records x capacity][record slabs]
+        [gap sizes x capacity][gap nodes x capacity][ptr_ix x 2 capacity][pool.mem]
+    so nothing has to be rebuilt when the file is opened again. The mapping is placed
+    at the address it was created at, which keeps the links between nodes valid. If the
+    kernel can't give that address back, every pointer is moved by the same delta,
+    which costs a pass over the metadata but never touches pool.mem. Shared pools
+    can't be moved, since other processes hold the same pointers, so they fail to open instead.
+    The node heap and the indexes can't be reallocated in place, so their capacity is fixed.
+*/
+/*
+    Snapshots:
+    A copy of the counters, the node heap (up to used_nodes) and the gap index, plus
+    the payload of the allocations only. Gaps hold nothing worth keeping, so the cost
+    follows the metadata and the live bytes, not total_size.
+*/
+typedef struct _pool_snapshot {
+    pool_mgr_pt pool_mgr;//the pool it was taken from, restore refuses any other.
+    pool_t pool;
+    node_head node_heap;
+    unsigned used_nodes;
+    unsigned free_nodes;
+    node_pt nodes;
+    gap_ix_t gap_ix;
+    char *payload;//allocations back to back, in list order.
+} pool_snapshot_t;
+
+/*
+    Range index:
+    The [mem, mem + total_size) of every open pool, sorted by mem. Pools don't overlap,
+    so the only one that can hold an address is the last to start at or below it.
+*/
+typedef struct _pool_range {
+    char *mem;
+    size_t size;
+    pool_mgr_pt pool_mgr;
+} pool_range_t, *pool_range_pt;
+
+typedef struct _pool_map {
+    unsigned long magic;
+    unsigned version;
+    unsigned capacity;//of the node heap and of the gap index.
+    char *base;//the address the mapping was created at.
+    size_t map_size;
+    size_t total_size;
+    alloc_policy policy;
+    unsigned shared;//opened by several processes, lock is used.
+    pthread_mutex_t lock;//process-shared, guards the rest of the mapping.
+} pool_map_t, *pool_map_pt;
+
+/*
+    NUMA groups:
+    One heap pool per node, its memory bound to that node. The group only picks the
+    pool; allocating from it is mem_new_alloc as usual.
+*/
+typedef struct _numa_group {
+    unsigned num_pools;//the highest online node + 1, pools[i] lives on node i...
+    pool_pt *pools;//...and is NULL when node i isn't online.
+    unsigned first;//the lowest online node, for a thread on any other.
+} numa_group_t;
+
+#define MEM_GROUP_CLASSES_MAX 16 //size ranges one pool group can route between
+
+/*
+    Pool groups:
+    A request goes to the first class whose max_size covers it, and is served by the
+    newest pool of the class with room, or by a new pool of the class when none has
+    any. A request above every class gets a pool of exactly its size, closed again
+    when it's freed. A free finds its pool with mem_pool_of, and the pool's group
+    tells whether it's one of ours. Only the class pools are kept in members; a
+    dedicated pool is reachable from its one allocation, and is counted.
+*/
+typedef struct _mem_group {
+    mem_group_class_t classes[MEM_GROUP_CLASSES_MAX];
+    unsigned num_classes;
+    pool_pt newest[MEM_GROUP_CLASSES_MAX];//of each class, tried first.
+    pool_pt *members;//the class pools, in the order they were opened.
+    unsigned num_members;
+    unsigned members_capacity;
+    unsigned num_dedicated;//open dedicated pools, each holding one allocation.
+} mem_group_t;
+
+// small requests in 16-byte granules, the rest from size classes, above 64 KiB a pool each.
+static const mem_group_class_t MEM_GROUP_DEFAULT_CLASSES[] = {
+        {256, 1 << 20, 16, FIRST_FIT},
+        {64 * 1024, 16 << 20, 0, GOOD_FIT},
+};
+
 /***************************/
 /*                         */
 /* Static global variables */
@@ -299,6 +729,9 @@ typedef struct _pool_mgr {
 static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
 static unsigned pool_store_size = 0;//current pool strorage size.
 static unsigned pool_store_capacity = 0;//pool capacity
+static pool_range_pt pool_range_ix = NULL;//every open pool's memory, sorted by address.
+static unsigned pool_range_count = 0;
+static unsigned pool_range_capacity = 0;//kept ahead of the store, so adding a range can't fail.
 
 
 
@@ -308,6 +741,18 @@ static unsigned pool_store_capacity = 0;//pool capacity
 /*                                          */
 /********************************************/
 static alloc_status _mem_resize_pool_store();
+static alloc_status _mem_reserve_pool_store_slot(size_t *slot);
+static alloc_status _mem_remove_from_pool_store(pool_mgr_pt pool_mgr);
+static unsigned _mem_range_ix_upper(const char *mem);
+static void _mem_range_ix_add(pool_mgr_pt pool_mgr);
+static void _mem_range_ix_remove(pool_mgr_pt pool_mgr);
+static alloc_status _mem_unmap_pool(pool_mgr_pt pool_mgr);
+static void _mem_rebase_mapped(pool_mgr_pt pool_mgr, ptrdiff_t delta);
+static size_t _mem_align_up(size_t n, size_t align);
+static pool_pt _mem_pool_open_mapped(int fd, char shared, char is_new, size_t size, alloc_policy policy);
+static void *_mem_rebase(void *p, ptrdiff_t delta);
+static void _mem_lock(pool_mgr_pt pool_mgr);
+static void _mem_unlock(pool_mgr_pt pool_mgr);
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
 static alloc_status
@@ -318,14 +763,62 @@ static alloc_status
         _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                 size_t size,
                                 node_pt node);
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
-void _print_node( node_pt n);
+static unsigned _mem_gap_lower_bound(pool_mgr_pt pool_mgr, size_t size, const char *mem);
+static unsigned _mem_gap_find(pool_mgr_pt pool_mgr, size_t size);
+static int _mem_gap_ix_lazy(pool_mgr_pt pool_mgr);
+static void _mem_sync_gap_ix(pool_mgr_pt pool_mgr);
+static int _mem_gap_before(pool_mgr_pt pool_mgr, unsigned i, unsigned j);
+static void _mem_gap_sift_down(pool_mgr_pt pool_mgr, unsigned i, unsigned n);
+static alloc_status _mem_merge_next_gap(pool_mgr_pt pool_mgr, node_pt gap);
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size);
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc);
+static void _mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
+static alloc_status _mem_pool_compact(pool_mgr_pt pool_mgr, size_t budget);
+static alloc_status _mem_free_node(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_unlink_node(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_status _mem_ptr_ix_init(pool_mgr_pt pool_mgr, ptr_ix_pt entries, unsigned capacity);
+static alloc_status _mem_ptr_ix_add(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_status _mem_ptr_ix_put(pool_mgr_pt pool_mgr, char *mem, size_t value);
+static alloc_status _mem_ptr_ix_get(pool_mgr_pt pool_mgr, char *mem, size_t *value);
+static void _mem_ptr_ix_remove(pool_mgr_pt pool_mgr, char *mem);
+static node_pt _mem_ptr_ix_find(pool_mgr_pt pool_mgr, char *mem);
+static alloc_status _mem_ptr_ix_rebuild(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_tag_new_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_tag_free(pool_mgr_pt pool_mgr, tag_pt block);
+static void _mem_tag_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments);
+static void _mem_tag_set(tag_pt block, size_t size, size_t allocated);
+static alloc_pt _mem_bitmap_new_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_bitmap_free(pool_mgr_pt pool_mgr, char *mem, alloc_pt alloc);
+static void _mem_bitmap_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments);
+static void _mem_bitmap_release(pool_mgr_pt pool_mgr);
+static void _mem_swap_with_next(node_head_pt head, node_pt node);
+static void _mem_zero(char *mem, size_t size);
+static void _mem_prefault(char *mem, size_t size);
+static unsigned _mem_numa_online(unsigned long *online, unsigned *span);
+static pool_pt _mem_group_open_pool(mem_group_pt group, unsigned cls, size_t size);
+static alloc_status _mem_numa_place(char *mem, size_t size, numa_placement placement, unsigned node);
+static size_t _mem_size_class(pool_mgr_pt pool_mgr, size_t size);
+static int _mem_good_fit(pool_mgr_pt pool_mgr, size_t gap_size, size_t size);
+static node_pt _mem_gap_node(pool_mgr_pt pool_mgr, unsigned i);
+static unsigned _mem_node_offset(pool_mgr_pt pool_mgr, node_pt node);
+static unsigned _mem_gap_scan_scalar(const size_t *sizes, unsigned n, size_t size);
+static gap_scan_fn _mem_select_gap_scan(void);
+#ifndef NDEBUG
+static int _mem_gap_scan_agrees(const size_t *sizes, unsigned n, size_t size);
+#endif
+static alloc_status _mem_coalesce_node(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_pt _mem_quick_take(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_quick_flush(pool_mgr_pt pool_mgr);
+void _print_node( node_pt n, node_head_pt head);
 void _print_gap_ix( pool_mgr_pt, char);
 
+// the gap index search, picked by mem_init() from what the CPU supports.
+static gap_scan_fn _mem_gap_scan = _mem_gap_scan_scalar;
+
 void _print_gap_ix(pool_mgr_pt p, char c){
     size_t i = 0;
     while(i < p->pool.num_gaps){
-        printf( "%c%u : %u\n" , c, (unsigned int)i, (unsigned int)p->gap_ix[i].size );
+        printf( "%c%u : %u\n" , c, (unsigned int)i, (unsigned int)p->gap_ix.size[i] );
         i++;
     }
 }
@@ -351,11 +844,11 @@ node_head_pt clear_node_list(node_head_pt head){
     while(iter != NULL){
         iter->allocated = 0;
         iter->used = 0;
-        iter->alloc_record.mem = NULL;
-        iter->alloc_record.size = 0;
-        iter = iter->next;
+        node_set_mem(iter, head, NULL);
+        node_set_size(iter, head, 0);
+        iter = node_get_next(iter, head);
         if(iter != NULL){
-            iter->prev = NULL;
+            node_set_prev(iter, head, NULL);
         }
     }
     iter = NULL;
@@ -368,6 +861,13 @@ node_head_pt delete_node_list(node_head_pt head){
     if(head != NULL){
         free((void*)(head->_nodes) );
         head->_nodes = NULL;
+        size_t s = 0;
+        while (s < (head->max_size + MEM_RECORD_SLAB - 1) / MEM_RECORD_SLAB){
+            free((void*)(head->_records[s]) );
+            s += 1;
+        }
+        free((void*)(head->_records) );
+        head->_records = NULL;
         head->max_size = 0;
         return head;
     }
@@ -396,10 +896,13 @@ alloc_status mem_init() {
     // allocate the pool store with initial capacity
     // note: holds pointers only, other functions to allocate/deallocate
     if (pool_store == NULL){
-        pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
-        pool_store = (pool_mgr_pt*)malloc( sizeof(pool_mgr_pt) * MEM_POOL_STORE_INIT_CAPACITY);;//initialize the pool to its initial capacity.
+        _mem_gap_scan = _mem_select_gap_scan();
+        //calloc'd, the slots up to pool_store_size are read as open or not.
+        pool_store = (pool_mgr_pt*)calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
         if(pool_store != NULL)
         {
+            pool_store_size = 0;
+            pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
             return ALLOC_OK;
         }else{
             return ALLOC_FAIL;
@@ -421,6 +924,12 @@ alloc_status mem_free() {
         //eliminates allocation of i and assignment of pool store size to zero.
         free((void*)pool_store);
         pool_store = NULL;
+        pool_store_size = 0;//the next mem_init starts over with a smaller store.
+        pool_store_capacity = 0;
+        free((void*)pool_range_ix);
+        pool_range_ix = NULL;
+        pool_range_count = 0;
+        pool_range_capacity = 0;
         return ALLOC_OK;
     }
     pool_store_size = 0;
@@ -429,28 +938,65 @@ alloc_status mem_free() {
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
+    return mem_pool_open_ex(size, policy, NULL);
+}
+
+// mem_pool_open with the node heap and gap index sized up front and grown as config
+// says. Fields left 0 (or config == NULL) take the defaults. A pool that is going to
+// hold many segments can start at that size instead of doubling its way there.
+pool_pt mem_pool_open_ex(size_t size, alloc_policy policy, const mem_pool_config_t *config) {
     // make sure there the pool store is allocated
     if (pool_store == NULL){
         return NULL;
     }
-    // expand the pool store, if necessary
-    size_t insertion_point = 0;
-    size_t original_size = pool_store_size;
-    //finds the first pool address in the pool store that is non-null
-    //In theory, there should only be a small number of possible pools
-    //Or if there are a great number of pools, finding them individually is preferable
-    //to running out of them prematurely because you don't recycle them.
-    while (insertion_point < pool_store_size && pool_store[insertion_point] != NULL){
-        insertion_point += 1;
+    mem_pool_config_t conf = {
+            .node_heap_capacity = MEM_NODE_HEAP_INIT_CAPACITY,
+            .node_heap_fill_factor = MEM_NODE_HEAP_FILL_FACTOR,
+            .node_heap_expand_factor = MEM_NODE_HEAP_EXPAND_FACTOR,
+            .gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY,
+            .gap_ix_fill_factor = MEM_GAP_IX_FILL_FACTOR,
+            .gap_ix_expand_factor = MEM_GAP_IX_EXPAND_FACTOR,
+            .prefault = 0,
+            .numa = NUMA_DEFAULT,
+            .numa_node = 0
+    };
+    unsigned ptr_ix_capacity = MEM_PTR_IX_INIT_CAPACITY;
+    if (config != NULL){
+        if (config->node_heap_capacity != 0){
+            conf.node_heap_capacity = config->node_heap_capacity;
+            //every allocation has an entry, so size the pointer index for as many.
+            while ((float) ptr_ix_capacity * MEM_PTR_IX_FILL_FACTOR < (float) conf.node_heap_capacity
+                   && ptr_ix_capacity < 0x80000000u){
+                ptr_ix_capacity *= 2;
+            }
+        }
+        conf.node_heap_fill_factor = (config->node_heap_fill_factor != 0) ? config->node_heap_fill_factor : conf.node_heap_fill_factor;
+        conf.node_heap_expand_factor = (config->node_heap_expand_factor != 0) ? config->node_heap_expand_factor : conf.node_heap_expand_factor;
+        conf.gap_ix_capacity = (config->gap_ix_capacity != 0) ? config->gap_ix_capacity : conf.gap_ix_capacity;
+        conf.gap_ix_fill_factor = (config->gap_ix_fill_factor != 0) ? config->gap_ix_fill_factor : conf.gap_ix_fill_factor;
+        conf.gap_ix_expand_factor = (config->gap_ix_expand_factor != 0) ? config->gap_ix_expand_factor : conf.gap_ix_expand_factor;
+    }
+    //a fill factor above 1 or an expand factor of 1 would never leave room to grow into.
+    if (conf.node_heap_fill_factor < 0 || conf.node_heap_fill_factor > 1 || conf.node_heap_expand_factor < 2
+        || conf.gap_ix_fill_factor < 0 || conf.gap_ix_fill_factor > 1 || conf.gap_ix_expand_factor < 2){
+        return NULL;
     }
-    if (insertion_point >= pool_store_size){
-        insertion_point = pool_store_size;
-        pool_store_size+=1;
+#ifdef MEM_POOL_COMPACT_NODES
+    if (conf.node_heap_capacity >= MEM_NODE_NIL){
+        return NULL;
     }
-    if( _mem_resize_pool_store() == ALLOC_FAIL){
-        pool_store_size= original_size;//correct pool size.
+#endif
+#ifdef MEM_POOL_COMPACT_NODES
+    if (size > 0xFFFFFFFFu){//compact nodes hold 32-bit offsets
+        return NULL;
+    }
+#endif
+    // expand the pool store, if necessary
+    size_t insertion_point = 0;
+    if (_mem_reserve_pool_store_slot(&insertion_point) != ALLOC_OK){
         return NULL;//If an unrecoverable error occurs, return nothing.
     }
+    char prefault = (config != NULL && config->prefault);
     // allocate a new mem pool mgr
     pool_mgr_pt pool_mgr = (pool_mgr_pt)malloc( sizeof( pool_mgr_t ) );
     if (pool_mgr == NULL){
@@ -458,13 +1004,22 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     }
 
     // allocate a new memory pool
-    pool_mgr->pool.mem = (char*)malloc( sizeof(char)*size );//allocate raw memory.
+    pool_mgr->pool.mem = (char*)calloc( size, sizeof(char) );//allocate raw memory, zero pages come free from mmap.
     // check success, on error deallocate mgr and return null
     if (pool_mgr->pool.mem == NULL){
         free ( ( void* ) pool_mgr);
         pool_mgr = NULL;
         return NULL;
     }
+    //placed before it's faulted in, so the pages are allocated where they belong.
+    if (config != NULL && _mem_numa_place(pool_mgr->pool.mem, size, config->numa, config->numa_node) != ALLOC_OK){
+        free(pool_mgr->pool.mem);
+        free(pool_mgr);
+        return NULL;
+    }
+    if (prefault){//take the page faults now rather than on the first allocations.
+        _mem_prefault(pool_mgr->pool.mem, size);
+    }
 
     pool_mgr->pool.total_size = size;//lets say that total size is the total size allocated
     pool_mgr->pool.alloc_size = 0;//lets say that the current size allocated
@@ -475,7 +1030,7 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     // allocate a new node heap
     pool_mgr->node_heap = malloc(sizeof(node_head));//allocate a new node_head
     pool_mgr->node_heap->_nodes = NULL;//make sure this points to nothing.
-    pool_mgr->node_heap = node_head_init(pool_mgr->node_heap, MEM_NODE_HEAP_INIT_CAPACITY);
+    pool_mgr->node_heap = node_head_init(pool_mgr->node_heap, conf.node_heap_capacity);
 
     // check success, on error deallocate mgr/pool and return null
     if(pool_mgr->node_heap == NULL){
@@ -487,9 +1042,12 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     }
 
     // allocate a new gap index
-    pool_mgr->gap_ix = malloc(sizeof(gap_t) * MEM_GAP_IX_INIT_CAPACITY);
+    pool_mgr->gap_ix.size = (size_t*) malloc(sizeof(size_t) * conf.gap_ix_capacity);
+    pool_mgr->gap_ix.node = (unsigned*) malloc(sizeof(unsigned) * conf.gap_ix_capacity);
     // check success, on error deallocate mgr/pool/heap and return null
-    if(pool_mgr->gap_ix == NULL){
+    if(pool_mgr->gap_ix.size == NULL || pool_mgr->gap_ix.node == NULL){
+        free( (void*) pool_mgr->gap_ix.size);
+        free( (void*) pool_mgr->gap_ix.node);
         free( (void*) pool_mgr->pool.mem);
         pool_mgr->pool.mem=NULL;
         free( (void*) pool_mgr->node_heap);
@@ -499,27 +1057,60 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
         return NULL;
     }
 
+    // allocate a new pointer index
+    if(_mem_ptr_ix_init(pool_mgr, (ptr_ix_pt) malloc(sizeof(ptr_ix_t) * ptr_ix_capacity),
+                        ptr_ix_capacity) != ALLOC_OK){
+        free( (void*) pool_mgr->gap_ix.size);
+        free( (void*) pool_mgr->gap_ix.node);
+        free( (void*) pool_mgr->pool.mem);
+        delete_node_list(pool_mgr->node_heap);
+        free( (void*) pool_mgr->node_heap);
+        free( (void*) pool_mgr);
+        return NULL;
+    }
+
     // assign all the pointers and update meta data:
     //for node heap:
     //   initialize top node of node heap
+#ifdef MEM_POOL_COMPACT_NODES
+    pool_mgr->node_heap->mem = pool_mgr->pool.mem;
+#endif
     node_list_insert( node_from_offset(pool_mgr->node_heap, 0), pool_mgr->node_heap, NULL);
     //Updating metadata
     node_begin(pool_mgr)->used = 1;//means it's part of the list
     node_begin(pool_mgr)->allocated = 0;//means it is a gap.
-    node_begin(pool_mgr)->alloc_record.mem = pool_mgr->pool.mem;
-    node_begin(pool_mgr)->alloc_record.size = size;
+    node_begin(pool_mgr)->zeroed = 1;//calloc'd
+    node_set_mem(node_begin(pool_mgr), pool_mgr->node_heap, pool_mgr->pool.mem);
+    node_set_size(node_begin(pool_mgr), pool_mgr->node_heap, size);
     //   initialize top node of gap index
-    pool_mgr->gap_ix->node = node_begin(pool_mgr);
-    pool_mgr->gap_ix->size = size;//needs to be the size of the new gap.
+    pool_mgr->gap_ix.node[0] = 0;//the offset of the top node
+    pool_mgr->gap_ix.size[0] = size;//needs to be the size of the new gap.
     //   initialize pool mgr
-    pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
-    pool_mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+    pool_mgr->gap_ix_capacity = conf.gap_ix_capacity;
+    pool_mgr->gap_ix_stale = 0;
+    pool_mgr->total_nodes = conf.node_heap_capacity;
     pool_mgr->used_nodes = 1;
+    pool_mgr->free_nodes = 0;
+    pool_mgr->node_heap_fill_factor = conf.node_heap_fill_factor;
+    pool_mgr->node_heap_expand_factor = conf.node_heap_expand_factor;
+    pool_mgr->gap_ix_fill_factor = conf.gap_ix_fill_factor;
+    pool_mgr->gap_ix_expand_factor = conf.gap_ix_expand_factor;
+    pool_mgr->map = NULL;//lives on the heap, not in a mapping.
+    pool_mgr->tagged = 0;
+    pool_mgr->granule = 0;
+    pool_mgr->num_size_classes = 0;
+    pool_mgr->min_gap = 0;
+    pool_mgr->quick_threshold = 0;
+    pool_mgr->quick_count = 0;
+    memset(&pool_mgr->stats, 0, sizeof(pool_stats_t));
+    pool_mgr->good_fit_slack = MEM_GOOD_FIT_SLACK;
+    pool_mgr->group = NULL;
     //   link pool mgr to pool store
-    pool_store[pool_store_size-1] = pool_mgr;
+    pool_store[insertion_point] = pool_mgr;
+    _mem_range_ix_add(pool_mgr);
     pool_mgr = NULL;
     // return the address of the mgr, cast to (pool_pt)
-    return (pool_pt)pool_store[pool_store_size-1];
+    return (pool_pt)pool_store[insertion_point];
 
 }
 
@@ -529,6 +1120,18 @@ alloc_status mem_pool_close(pool_pt pool) {
     if(pool == NULL){
         return ALLOC_FAIL;
     }
+    // coalesce what deferred coalescing held back
+    _mem_lock((pool_mgr_pt) pool);
+    alloc_status flushed = (((pool_mgr_pt) pool)->tagged || ((pool_mgr_pt) pool)->granule != 0)
+                           ? ALLOC_OK : _mem_quick_flush((pool_mgr_pt) pool);
+    _mem_unlock((pool_mgr_pt) pool);
+    if(flushed != ALLOC_OK){
+        return ALLOC_NOT_FREED;
+    }
+    //a mapped pool keeps its allocations in the file, it is only detached.
+    if(((pool_mgr_pt) pool)->map != NULL){
+        return _mem_unmap_pool((pool_mgr_pt) pool);
+    }
 
     // check if pool has only one gap
     // check if it has zero allocations
@@ -556,28 +1159,25 @@ alloc_status mem_pool_close(pool_pt pool) {
         pool_mgr->node_heap = NULL;//everything else is null.
     }
     // free gap index
-    size_t i=0;//set initializer
-    if(pool_mgr->gap_ix != NULL){
-        while (i < pool_mgr->pool.num_gaps){
-            pool_mgr->gap_ix[i].node = NULL;//these where already freed.
-            i+=1;
-        }
-        free((void*)pool_mgr->gap_ix);
-        pool_mgr->gap_ix = NULL;
-    };
+    free((void*)pool_mgr->gap_ix.size);
+    free((void*)pool_mgr->gap_ix.node);
+    pool_mgr->gap_ix.size = NULL;
+    pool_mgr->gap_ix.node = NULL;
+    // free pointer index
+    free((void*)pool_mgr->ptr_ix);
+    pool_mgr->ptr_ix = NULL;
+    // free the bitmaps and the records of a bitmap pool
+    if (pool_mgr->granule != 0){
+        _mem_bitmap_release(pool_mgr);
+    }
     // find mgr in pool store and set to null
     // free mgr
     pool_mgr->total_nodes=0;
     pool_mgr->used_nodes=0;
     // note: don't decrement pool_store_size, because it only grows
-    i = 0;
-    while (i < pool_store_size){
-        if(pool_store[i] == pool_mgr){
-            pool_store[i] = NULL;
-            free(pool_mgr);
-            return ALLOC_OK;
-        }
-        i+=1;
+    if(_mem_remove_from_pool_store(pool_mgr) == ALLOC_OK){
+        free(pool_mgr);
+        return ALLOC_OK;
     }
             printf("FAIL!\n");
     return ALLOC_NOT_FREED;
@@ -585,8 +1185,34 @@ alloc_status mem_pool_close(pool_pt pool) {
 
 
 alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
+    _mem_lock((pool_mgr_pt) pool);
+    alloc_pt alloc = _mem_new_alloc(pool, size);
+    _mem_unlock((pool_mgr_pt) pool);
+    return alloc;
+}
+
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    node_head_pt head = pool_mgr->node_heap;
+    if(pool_mgr->tagged){
+        return _mem_tag_new_alloc(pool_mgr, size);
+    }
+    if(pool_mgr->granule != 0){
+        return _mem_bitmap_new_alloc(pool_mgr, size);
+    }
+    size = _mem_size_class(pool_mgr, size);
+    // a block of exactly this size freed recently is reused as is, otherwise
+    // everything held back is coalesced before searching the gaps
+    if(pool_mgr->quick_threshold != 0){
+        alloc_pt alloc = _mem_quick_take(pool_mgr, size);
+        if(alloc != NULL){
+            return alloc;
+        }
+        if(_mem_quick_flush(pool_mgr) != ALLOC_OK){
+            return NULL;
+        }
+    }
     // check if any gaps, return null if none
     if(pool_mgr->pool.num_gaps == 0){
         return NULL;
@@ -612,7 +1238,7 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
         //if nothing is allocated, return the node heap
         if(pool->num_allocs == 0 ){
             insert_node = node_begin(pool_mgr);
-            if(insert_node->alloc_record.size < size || insert_node->allocated == 1){
+            if(node_get_size(insert_node, head) < size || insert_node->allocated == 1){
                 printf("YOU REALLY GOOFED 1\n");
                 insert_node = NULL;
             }
@@ -626,98 +1252,116 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
         //if it is not a fit, query list for for first fit.
         //If no node of the correct size is found return null.
             while( insert_node != NULL && found == 0){//and if that isn't allocated, spin till you find one that is allocated.
-                if(( insert_node->alloc_record.size >= size ) && ( insert_node->allocated == 0 )){
+                if(( node_get_size(insert_node, head) >= size ) && ( insert_node->allocated == 0 )){
                     found = 1;
                 }else{
-                    insert_node = insert_node->next;
+                    insert_node = node_get_next(insert_node, head);
                 }
             }
         }
     }
     else if (pool->policy == BEST_FIT)
     {
-        node_pt iter = NULL;//See note
-        insert_node = NULL;
-        size_t gap_i = 0;
-        while (gap_i < pool->num_gaps && insert_node == NULL){
-            if(pool_mgr->gap_ix[gap_i].size >= size){
-                insert_node = pool_mgr->gap_ix[gap_i].node;
-            }
-            gap_i+=1;
-        }
-        //simply move through the array of gaps until one is found.
-        //Remove that gap using gap removal function call.
-        /*Test 19 states that nodes should be in some kind of order.
-        Therefore, do a quick search to find the first node of that
-        size and make that the insertion point.
-        */
-        if(insert_node != NULL){
-            iter = node_begin(pool_mgr);
-            while (iter != insert_node){
-                if(iter->alloc_record.size == insert_node->alloc_record.size && iter->allocated == 0){
+        //the index is ordered by size and then address, so the first gap big enough
+        //is also the lowest in memory of its size, which test 19 expects.
+        _mem_sync_gap_ix(pool_mgr);
+        unsigned gap_i = _mem_gap_find(pool_mgr, size);
+        if (gap_i < pool->num_gaps){
+            insert_node = _mem_gap_node(pool_mgr, gap_i);
+        }
+    }
+    else if (pool->policy == WORST_FIT)
+    {
+        //the gap index is sorted by size, so the largest gap is its last entry.
+        _mem_sync_gap_ix(pool_mgr);
+        if (pool->num_gaps > 0 && pool_mgr->gap_ix.size[pool->num_gaps - 1] >= size){
+            insert_node = _mem_gap_node(pool_mgr, pool->num_gaps - 1);
+        }
+    }
+    else if (pool->policy == GOOD_FIT)
+    {
+        //the first gap in address order that is close enough in size,
+        //and if none is, the best fit.
+        node_pt best = NULL;
+        node_pt iter = node_begin(pool_mgr);
+        while (iter != NULL && insert_node == NULL){
+            if (iter->allocated == 0 && node_get_size(iter, head) >= size){
+                if (_mem_good_fit(pool_mgr, node_get_size(iter, head), size)){
                     insert_node = iter;
-                }else{
-                    iter = iter->next;
+                }else if (best == NULL || node_get_size(iter, head) < node_get_size(best, head)){
+                    best = iter;
                 }
             }
-            iter = NULL;
+            iter = node_get_next(iter, head);
+        }
+        if (insert_node == NULL){
+            insert_node = best;
         }
     }else{
     //no recognizable policy provided? assert false
-        assert(pool->policy == BEST_FIT || pool->policy == FIRST_FIT );
+        assert(pool->policy == BEST_FIT || pool->policy == FIRST_FIT
+               || pool->policy == WORST_FIT || pool->policy == GOOD_FIT);
     }
 
     // check if node found
     if (insert_node == NULL){
         return NULL;
     }
+    // a remainder too small to be worth a node is handed out with the allocation
+    if (node_get_size(insert_node, head) - size < pool_mgr->min_gap){
+        size = node_get_size(insert_node, head);
+    }
+    // index the payload address, the start of the gap becomes the start of the allocation
+    if (_mem_ptr_ix_add(pool_mgr, insert_node) != ALLOC_OK){
+        return NULL;
+    }
     // update metadata (num_allocs, alloc_size)
     pool->num_allocs+=1;
     pool->alloc_size+=size;
     // calculate the size of the remaining gap, if any
-    size_t rem_gap = insert_node->alloc_record.size - size;
-    assert(rem_gap <= insert_node->alloc_record.size);//overflow catch
-    // remove node from gap index
-    assert(_mem_remove_from_gap_ix(pool_mgr, size, insert_node) == ALLOC_OK);
+    size_t rem_gap = node_get_size(insert_node, head) - size;
+    assert(rem_gap <= node_get_size(insert_node, head));//overflow catch
+    // remove node from gap index, where it's filed under its size as a gap
+    alloc_status indexed = _mem_remove_from_gap_ix(pool_mgr, node_get_size(insert_node, head), insert_node);
+    assert(indexed == ALLOC_OK);
+    (void) indexed;
     // convert gap_node to an allocation node of given size
     insert_node->allocated = 1;
     insert_node->used = 1;
-    insert_node->alloc_record.size = size;
+    node_set_size(insert_node, head, size);
     //The insert_nodes allocation record pointer is adjusted.
     // adjust node heap:
     //   if remaining gap, need a new node
     node_pt new_gap = NULL;
     if(rem_gap != 0){
     //   needs to either exist in the heap as an unused node, or needs to be created
-        new_gap = pool_mgr->node_heap->_nodes;
-        size_t i = 0;
-        //find an unused node. Do this by searching through all previously used nodes (this is what used nodes will be)
-        while( i < pool_mgr->used_nodes && new_gap[i].used != 0){
-            ++i;
-        }
-
-        //if no unused node is found, make sure you have enough nodes in the heap...
-        if(i ==  pool_mgr->used_nodes){
+        //if no unused node is waiting in the free list, make sure you have enough nodes in the heap...
+        if(pool_mgr->free_nodes == 0){
+            size_t insert_ix = (size_t) (insert_node - head->_nodes);
             if(_mem_resize_node_heap(pool_mgr) != ALLOC_OK){
                 return NULL;
             }
+            insert_node = &head->_nodes[insert_ix];//the heap may have moved.
             //then get a new gap
             new_gap = node_from_offset(pool_mgr->node_heap,pool_mgr->used_nodes);
             //did not find an unused node. Therefore create a new node to refer to it in the node_heap
             //update metadata (used_nodes)
             //   update linked list (new node right after the node for allocation)
             pool_mgr->used_nodes+=1;
-        }else{//but if one is found point to it.
-            new_gap = &new_gap[i];
+        }else{//but if one is waiting take it off the list.
+            new_gap = &head->_nodes[pool_mgr->free_nodes - 1];
+            pool_mgr->free_nodes = (unsigned) node_get_size(new_gap, head);
         }
         node_list_insert(new_gap, pool_mgr->node_heap, insert_node);
         new_gap->used = 1;
         new_gap->allocated = 0;
-        new_gap->alloc_record.size = rem_gap;
+        new_gap->zeroed = insert_node->zeroed;
+        node_set_size(new_gap, head, rem_gap);
         //the starting index of the gap is the next available memory slice.
-        new_gap->alloc_record.mem =(char *) (insert_node->alloc_record.mem + size-1);
+        node_set_mem(new_gap, head, node_get_mem(insert_node, head) + size);
         //   initialize it to a gap node
-        assert( _mem_add_to_gap_ix(pool_mgr, rem_gap, new_gap) == ALLOC_OK );
+        indexed = _mem_add_to_gap_ix(pool_mgr, rem_gap, new_gap);
+        assert(indexed == ALLOC_OK);
         //   add to gap index
         //   check if successful <-done with assert.
         new_gap = NULL;//wipe out local reference just in case
@@ -725,33 +1369,50 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
     // return allocation record by casting the node to (alloc_pt)
     //or you can just, you know, return the node.
 
-    return &(insert_node->alloc_record);
+    return node_get_alloc(insert_node, head);
 }
 
-void _print_node( node_pt n){
-    printf("ADDR_AT: %p\n", n);
-    printf("Alloc-used: %u-%u next->%p prev%p\n", n->allocated, n->used, n->next, n->prev);
-    printf("Size: %u Memoryaddr: %p\n", (unsigned int)n->alloc_record.size, n->alloc_record.mem);
+void _print_node( node_pt n, node_head_pt head){
+    printf("ADDR_AT: %p\n", (void*) n);
+    printf("Alloc-used: %u-%u next->%p prev%p\n", (unsigned) n->allocated, (unsigned) n->used,
+           (void*) node_get_next(n, head), (void*) node_get_prev(n, head));
+    printf("Size: %u Memoryaddr: %p\n", (unsigned int)node_get_size(n, head), (void*) node_get_mem(n, head));
 }
 
 alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+    _mem_lock((pool_mgr_pt) pool);
+    alloc_status status = _mem_del_alloc(pool, alloc);
+    _mem_unlock((pool_mgr_pt) pool);
+    return status;
+}
+
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr= (pool_mgr_pt)pool;
-    // get node from alloc by casting the pointer to (node_pt)
-    //node_pt node = (node_pt) alloc;
-    node_pt init = (node_pt)alloc;// set up the allocation pointer from alloc
+    if(pool_mgr->tagged){
+        return _mem_tag_free(pool_mgr, (tag_pt) ((char*) alloc - offsetof(tag_t, record)));
+    }
+    if(pool_mgr->granule != 0){
+        return _mem_bitmap_free(pool_mgr, alloc->mem, alloc);
+    }
+    node_head_pt head = pool_mgr->node_heap;
+    // get node from alloc
+    node_pt init = alloc_get_node(alloc, head);// set up the allocation pointer from alloc
     node_pt iter =  node_begin(pool_mgr);//Point the iterator at the beginning of the node heap.
     //find the node in the node heap.
     while (iter != NULL && iter != init){
-        iter=iter->next;
+        iter=node_get_next(iter, head);
     }
     // this is node-to-delete -> init
     if(iter == NULL){
         return ALLOC_NOT_FREED;
     }
-    assert(&init->alloc_record == alloc);
     // make sure it's found
-    assert(&iter->alloc_record == alloc);
+    assert(node_get_alloc(iter, head) == alloc);
+    //already freed, only waiting to be coalesced
+    if( iter->allocated == MEM_NODE_DEFERRED){
+        return ALLOC_NOT_FREED;
+    }
     //check and make sure that its actually allocated in the first place
     if( iter->allocated != 1){
     //if it is not:
@@ -768,68 +1429,135 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
         if(pool_mgr->node_heap->length == 1){
             return ALLOC_OK;
         }
-        pool_mgr->node_heap->end->alloc_record.size+=iter->alloc_record.size;
+        node_set_size(head->end, head, node_get_size(head->end, head) + node_get_size(iter, head));
         remove_node( iter, pool_mgr->node_heap);
-        _mem_remove_from_gap_ix(pool_mgr, iter->alloc_record.size, iter);
+        _mem_remove_from_gap_ix(pool_mgr, node_get_size(iter, head), iter);
         return ALLOC_OK;
     }
-    // convert to gap node
+    return _mem_free_node(pool_mgr, iter);
+}
+
+// Frees by payload address, looked up in the pointer index instead of the node list.
+alloc_status mem_del_ptr(pool_pt pool, void *p) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr == NULL || p == NULL){
+        return ALLOC_FAIL;
+    }
+    _mem_lock(pool_mgr);//before the layout is looked at, as in mem_del_alloc.
+    alloc_status status = ALLOC_NOT_FREED;
+    if (pool_mgr->tagged){//the header is right in front of the payload.
+        status = _mem_tag_free(pool_mgr, (tag_pt) ((char*) p - sizeof(tag_t)));
+    }else if (pool_mgr->granule != 0){//the pointer index leads to the record.
+        status = _mem_bitmap_free(pool_mgr, (char*) p, NULL);
+    }else{
+        node_pt node = _mem_ptr_ix_find(pool_mgr, (char*) p);
+        if (node != NULL){
+            status = _mem_free_node(pool_mgr, node);
+        }
+    }
+    _mem_unlock(pool_mgr);
+    return status;
+}
+
+// Turns the allocation in node back into a gap, merging it with gap neighbours.
+// With deferred coalescing on, the block is parked in the quick list instead.
+static alloc_status _mem_free_node(pool_mgr_pt pool_mgr, node_pt iter) {
+    pool_pt pool = &pool_mgr->pool;
+    node_head_pt head = pool_mgr->node_heap;
+    if (pool_mgr->quick_threshold != 0 && pool_mgr->quick_count == pool_mgr->quick_threshold){
+        if (_mem_quick_flush(pool_mgr) != ALLOC_OK){
+            return ALLOC_NOT_FREED;
+        }
+    }
+    // the user has written to it
     iter->allocated = 0;
+    iter->zeroed = 0;
+    _mem_ptr_ix_remove(pool_mgr, node_get_mem(iter, head));
     // update metadata (num_allocs, alloc_size)
     pool->num_allocs -= 1;
-    pool->alloc_size -= alloc->size;
+    pool->alloc_size -= node_get_size(iter, head);
+    if (pool_mgr->quick_threshold != 0){
+        iter->allocated = MEM_NODE_DEFERRED;
+        pool_mgr->quick_node[pool_mgr->quick_count] = (unsigned) (iter - pool_mgr->node_heap->_nodes);
+        pool_mgr->quick_size[pool_mgr->quick_count] = node_get_size(iter, head);
+        pool_mgr->quick_count += 1;
+        return ALLOC_OK;
+    }
+    return _mem_coalesce_node(pool_mgr, iter);
+}
+
+// Merges the gap in node with the gaps next to it and indexes the result.
+static alloc_status _mem_coalesce_node(pool_mgr_pt pool_mgr, node_pt iter) {
+    node_head_pt head = pool_mgr->node_heap;
+    iter->allocated = 0;
     // if the next node in the list is also a gap, merge into node-to-delete
-    if(pool_mgr->node_heap->length > 1){// if the node has only one node, don't do anything
-        node_pt del_me = next_node(iter, pool_mgr->node_heap);
-        if (del_me->allocated == 0){//node is guaranteed to exist if there is more than one node, all you need to test if if the node is allocated.
-        //   remove the next node from gap index
-            alloc_status is_success = _mem_remove_from_gap_ix(pool_mgr, del_me->alloc_record.size, del_me);
-        //   check success
-            if (is_success == ALLOC_OK){
-        //   add the size to the node-to-delete
-                iter->alloc_record.size+=del_me->alloc_record.size;
-            }
-            else{
-                return ALLOC_NOT_FREED;
-            }
-        //   update node as unused
-            del_me->used = 0;
-            del_me->allocated = 0;
-        //   update metadata (used nodes)//done when remove from gap ix is called.->treating used as a total count of all nodes used ever, do not do this.
-        //   update linked list:
-            del_me = remove_node(del_me, pool_mgr->node_heap);//decreases count by one and updates the links.
-            //should I check or assert for some kind of error?
-        }
-        del_me = node_has_prev( iter , pool_mgr->node_heap );//make sure to reset del_me to null;
-        // this merged node-to-delete might need to be added to the gap index-> not yet, do the next check first.
-        // but one more thing to check...
-        // if the previous node in the list is also a gap, merge into previous!
-        if ( del_me != NULL && del_me->allocated == 0) {
-            node_pt del_me = iter;//say that delete me is iter.
-            iter = prev_node(iter, pool_mgr->node_heap);//say that the previous node is the iterator.
-            iter->alloc_record.size+=del_me->alloc_record.size;//unlike the other node, this one was never a part of the gap record to begin with.
-            //so just add the allocation size to the next node.
-            //   update node as unused
-            del_me->used = 0;
-            del_me->allocated = 0;
-        //   update linked list:
-            del_me = remove_node(del_me, pool_mgr->node_heap);
-            //updating this is tricky: you need to remove the iterator from the pool, then re-add it.
-            _mem_remove_from_gap_ix(pool_mgr, iter->alloc_record.size, iter);
-            //should I check for some kind of error.
-            del_me = NULL;
+    node_pt del_me = node_get_next(iter, head);
+    if (del_me != NULL && del_me->allocated == 0){
+    //   remove the next node from gap index
+        if (_mem_remove_from_gap_ix(pool_mgr, node_get_size(del_me, head), del_me) != ALLOC_OK){
+            return ALLOC_NOT_FREED;
+        }
+    //   add the size to the node-to-delete
+        node_set_size(iter, head, node_get_size(iter, head) + node_get_size(del_me, head));
+    //   update node as unused, update linked list:
+        _mem_unlink_node(pool_mgr, del_me);
+    }
+    // if the previous node in the list is also a gap, merge into previous!
+    del_me = node_get_prev(iter, head);
+    if (del_me != NULL && del_me->allocated == 0){
+        del_me = iter;
+        iter = node_get_prev(iter, head);
+        //the previous gap is indexed by its old size, take it out before it grows.
+        if (_mem_remove_from_gap_ix(pool_mgr, node_get_size(iter, head), iter) != ALLOC_OK){
+            return ALLOC_NOT_FREED;
         }
+        node_set_size(iter, head, node_get_size(iter, head) + node_get_size(del_me, head));
+        _mem_unlink_node(pool_mgr, del_me);
     }
     // add the resulting node to the gap index
-    return _mem_add_to_gap_ix(pool_mgr, iter->alloc_record.size, iter);
+    return _mem_add_to_gap_ix(pool_mgr, node_get_size(iter, head), iter);
+}
+
+// Like mem_new_alloc, but the payload is zeroed. Gaps remember whether their bytes
+// are still zero (fresh from calloc/ftruncate, never handed out), so the zeroing is
+// skipped for those and only done for memory that has been used before.
+alloc_pt mem_new_alloc_zeroed(pool_pt pool, size_t size) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    _mem_lock(pool_mgr);
+    alloc_pt alloc = _mem_new_alloc(pool, size);
+    if (alloc != NULL){
+        if (pool_mgr->tagged || pool_mgr->granule != 0){//no per-gap state, always zero.
+            _mem_zero(alloc->mem, alloc->size);
+        }else if (!alloc_get_node(alloc, pool_mgr->node_heap)->zeroed){
+            _mem_zero(alloc->mem, alloc->size);
+        }
+    }
+    _mem_unlock(pool_mgr);
+    return alloc;
 }
 
 //Using pointers as in-out variables.
 void mem_inspect_pool(pool_pt pool,
                       pool_segment_pt *segments,
                       unsigned *num_segments) {
+    _mem_lock((pool_mgr_pt) pool);
+    _mem_inspect_pool(pool, segments, num_segments);
+    _mem_unlock((pool_mgr_pt) pool);
+}
+
+static void _mem_inspect_pool(pool_pt pool,
+                              pool_segment_pt *segments,
+                              unsigned *num_segments) {
     // get the mgr from the pool
     pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if(pool_mgr->tagged){
+        _mem_tag_inspect(pool_mgr, segments, num_segments);
+        return;
+    }
+    if(pool_mgr->granule != 0){
+        _mem_bitmap_inspect(pool_mgr, segments, num_segments);
+        return;
+    }
     // allocate the segments array with size == used_nodes
     pool_segment_pt arr = (pool_segment_pt)malloc(sizeof(pool_segment_t)*pool_mgr->used_nodes);
     // check successful
@@ -844,11 +1572,11 @@ void mem_inspect_pool(pool_pt pool,
     i=0;
     while(iter != NULL){
         if(iter->used == 1){
-            arr[i].allocated = iter->allocated;
-            arr[i].size = iter->alloc_record.size;
+            arr[i].allocated = iter->allocated == 1;//a deferred block is free space
+            arr[i].size = node_get_size(iter, pool_mgr->node_heap);
         }
         i+=1;
-        iter = iter->next;
+        iter = node_get_next(iter, pool_mgr->node_heap);
     }
     // loop through the node heap and the segments array
     //    for each node, write the size and allocated in the segment
@@ -860,48 +1588,659 @@ void mem_inspect_pool(pool_pt pool,
 }
 
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
-// _mem_resize_pool_store
-/*
-    pre: There is a static pool_store with a pool_store_size and pool_store capacity.
-    There is constants MEM_POOL_STORE_FILL FACTOR, MEM_POOL_STORE_EXPAND_FACTOR
+// Slides the allocations toward the start of pool.mem, one at a time, merging the
+// gaps they leave behind. The allocation records stay in place and only their mem
+// is updated, so an alloc_pt held by the user is still valid, it just has to be re-read.
+// budget: the number of payload bytes that may be moved in this call, 0 for no limit.
+// At least one allocation is moved per call, so every call makes progress.
+// Returns ALLOC_OK when the pool is compacted (a single gap at the end, if any),
+// ALLOC_INCOMPLETE if the budget ran out first.
+alloc_status mem_pool_compact(pool_pt pool, size_t budget) {
+    if (pool == NULL){
+        return ALLOC_FAIL;
+    }
+    _mem_lock((pool_mgr_pt) pool);
+    alloc_status status = _mem_pool_compact((pool_mgr_pt) pool, budget);
+    _mem_unlock((pool_mgr_pt) pool);
+    return status;
+}
 
-*/
-static alloc_status _mem_resize_pool_store() {
-    // check if necessary
-    if (((float) pool_store_size / (float) pool_store_capacity)
-        < (float)MEM_POOL_STORE_FILL_FACTOR)
-    {
-        return ALLOC_OK;//and if it is not, inform that the allocation is okay.
+static alloc_status _mem_pool_compact(pool_mgr_pt pool_mgr, size_t budget) {
+    if (pool_mgr->node_heap == NULL){
+        return ALLOC_FAIL;
     }
-    unsigned new_capacity = ( unsigned ) ( pool_store_capacity * MEM_POOL_STORE_FILL_FACTOR );
-    //Check the new capacity is greater than the pool store capacity, could be less because of overflow
-    if (new_capacity > pool_store_capacity)
-    {
-        pool_mgr_pt* verify_store = ( pool_mgr_pt* ) realloc(
-        ( void* ) pool_store ,
-        sizeof(pool_mgr_pt) * MEM_POOL_STORE_EXPAND_FACTOR
-        );
-        //realloc returns a void pointer just to say if pool_store has been allocated.
-        //This pointer can be null if it fails. Check that.
-        if (verify_store != NULL)
-        {
-            // don't forget to update capacity variables
-            pool_store_capacity = new_capacity;
-            pool_store = verify_store;
-            verify_store = NULL;
-            return ALLOC_OK;
+    if (_mem_quick_flush(pool_mgr) != ALLOC_OK){
+        return ALLOC_FAIL;
+    }
+    node_head_pt head = pool_mgr->node_heap;
+    size_t moved = 0;
+    //find the first gap, everything before it is already compacted.
+    node_pt gap = node_begin(pool_mgr);
+    while (gap != NULL && gap->allocated == 1){
+        gap = node_get_next(gap, head);
+    }
+    while (gap != NULL && node_get_next(gap, head) != NULL){
+        node_pt next = node_get_next(gap, head);
+        if (next->allocated == 0){
+            //two gaps in a row, fold the second one into the first.
+            if (_mem_merge_next_gap(pool_mgr, gap) != ALLOC_OK){
+                return ALLOC_FAIL;
+            }
+            continue;
+        }
+        size_t size = node_get_size(next, head);
+        if (budget != 0 && moved != 0 && moved + size > budget){
+            return ALLOC_INCOMPLETE;
+        }
+        //the allocation takes the start of the gap, the gap moves up behind it.
+        char *to = node_get_mem(gap, head);
+        memmove(to, node_get_mem(next, head), size);
+        moved += size;
+        _mem_ptr_ix_remove(pool_mgr, node_get_mem(next, head));
+        node_set_mem(next, head, to);
+        if (_mem_ptr_ix_add(pool_mgr, next) != ALLOC_OK){//can't fail, an entry was just freed.
+            return ALLOC_FAIL;
         }
+        node_set_mem(gap, head, to + size);
+        gap->zeroed = 0;//the gap now covers bytes the allocation had
+        _mem_swap_with_next(pool_mgr->node_heap, gap);
     }
-    return ALLOC_FAIL;
+    return ALLOC_OK;
 }
 
 
-//If necessary to resize, resizes pool.
+// Opens a pool that lives in the file at path. A file this call creates is sized
+// and initialized with a single gap of size bytes. An existing file is checked
+// against size and policy and attached as is, with all its allocations.
+pool_pt mem_pool_open_file(const char *path, size_t size, alloc_policy policy) {
+    if (pool_store == NULL || path == NULL || size == 0){
+        return NULL;
+    }
+    //only the call that creates the file initializes it.
+    char is_new = 1;
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST){
+        is_new = 0;
+        fd = open(path, O_RDWR);
+    }
+    if (fd < 0){
+        perror("mem_pool_open_file");
+        return NULL;
+    }
+    return _mem_pool_open_mapped(fd, 0, is_new, size, policy);
+}
+
+// Opens a pool in the POSIX shared memory object name, creating it if this is the
+// first process to ask for it. Any process that has it open can allocate and free,
+// under a lock kept in the shared object itself. The pool is mapped at the same
+// address in every process, so alloc_pt and alloc->mem can be passed around as is.
+pool_pt mem_pool_open_shared(const char *name, size_t size, alloc_policy policy) {
+    if (pool_store == NULL || name == NULL || size == 0){
+        return NULL;
+    }
+    //only the process that creates the object initializes it.
+    char is_new = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST){
+        is_new = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0){
+        perror("mem_pool_open_shared");
+        return NULL;
+    }
+    pool_pt pool = _mem_pool_open_mapped(fd, 1, is_new, size, policy);
+    if (pool == NULL && is_new){
+        shm_unlink(name);
+    }
+    return pool;
+}
+
+alloc_status mem_pool_unlink_shared(const char *name) {
+    if (name == NULL || shm_unlink(name) != 0){
+        return ALLOC_FAIL;
+    }
+    return ALLOC_OK;
+}
+
+
+// Opens a pool in the boundary-tag layout, see tag_t. Segment sizes reported by
+// mem_inspect_pool are payload sizes, the tags themselves are not counted.
+pool_pt mem_pool_open_tagged(size_t size, alloc_policy policy) {
+    if (pool_store == NULL){
+        return NULL;
+    }
+    size_t block = size & ~(size_t) 7;//blocks are multiples of 8.
+    if (block < MEM_TAG_MIN_BLOCK){
+        return NULL;
+    }
+    size_t insertion_point = 0;
+    if (_mem_reserve_pool_store_slot(&insertion_point) != ALLOC_OK){
+        return NULL;
+    }
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    if (pool_mgr == NULL){
+        return NULL;
+    }
+    pool_mgr->pool.mem = (char*) malloc(size);
+    if (pool_mgr->pool.mem == NULL){
+        free(pool_mgr);
+        return NULL;
+    }
+    pool_mgr->pool.total_size = size;
+    pool_mgr->pool.alloc_size = 0;
+    pool_mgr->pool.num_allocs = 0;
+    pool_mgr->pool.num_gaps = 1;
+    pool_mgr->pool.policy = policy;
+    pool_mgr->tagged = 1;
+    pool_mgr->good_fit_slack = MEM_GOOD_FIT_SLACK;
+    _mem_tag_set((tag_pt) pool_mgr->pool.mem, block, 0);
+    pool_store[insertion_point] = pool_mgr;
+    _mem_range_ix_add(pool_mgr);
+    return (pool_pt) pool_mgr;
+}
+
+// Opens a pool in the bitmap layout, see _mem_bitmap_new_alloc. granule must be a
+// power of 2; requests are rounded up to a multiple of it, and what is left of size
+// after the last whole granule is not used.
+pool_pt mem_pool_open_bitmap(size_t size, size_t granule, alloc_policy policy) {
+    if (pool_store == NULL){
+        return NULL;
+    }
+    if (granule == 0 || (granule & (granule - 1)) != 0 || size / granule == 0){
+        return NULL;
+    }
+    size_t insertion_point = 0;
+    if (_mem_reserve_pool_store_slot(&insertion_point) != ALLOC_OK){
+        return NULL;
+    }
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
+    if (pool_mgr == NULL){
+        return NULL;
+    }
+    size_t words = (size / granule + 63) / 64;
+    pool_mgr->pool.mem = (char*) malloc(size);
+    pool_mgr->bitmap = (uint64_t*) calloc(words, sizeof(uint64_t));
+    pool_mgr->starts = (uint64_t*) calloc(words, sizeof(uint64_t));
+    if (pool_mgr->pool.mem == NULL || pool_mgr->bitmap == NULL || pool_mgr->starts == NULL
+        || _mem_ptr_ix_init(pool_mgr, (ptr_ix_pt) malloc(sizeof(ptr_ix_t) * MEM_PTR_IX_INIT_CAPACITY),
+                            MEM_PTR_IX_INIT_CAPACITY) != ALLOC_OK){
+        free(pool_mgr->pool.mem);
+        _mem_bitmap_release(pool_mgr);
+        free(pool_mgr);
+        return NULL;
+    }
+    pool_mgr->pool.total_size = size;
+    pool_mgr->pool.alloc_size = 0;
+    pool_mgr->pool.num_allocs = 0;
+    pool_mgr->pool.num_gaps = 1;
+    pool_mgr->pool.policy = policy;
+    pool_mgr->good_fit_slack = MEM_GOOD_FIT_SLACK;
+    pool_mgr->granule = granule;
+    pool_mgr->granule_shift = (unsigned) __builtin_ctzll((unsigned long long) granule);
+    pool_mgr->num_granules = size / granule;
+    pool_mgr->free_record = MEM_BITMAP_NO_RECORD;
+    pool_store[insertion_point] = pool_mgr;
+    _mem_range_ix_add(pool_mgr);
+    return (pool_pt) pool_mgr;
+}
+
+// Opens a pool on each NUMA node with mem_pool_open_ex (config's placement is replaced
+// by a bind to the node). A machine that isn't NUMA gets a group of one pool.
+numa_group_pt mem_numa_group_open(size_t size, alloc_policy policy, const mem_pool_config_t *config) {
+    numa_group_pt group = (numa_group_pt) calloc(1, sizeof(numa_group_t));
+    unsigned long online[MEM_NUMA_MAX_NODES / MEM_NUMA_WORD_BITS];
+    unsigned span = 0;
+    unsigned nodes = _mem_numa_online(online, &span);
+    if (group == NULL || (group->pools = (pool_pt*) calloc(span, sizeof(pool_pt))) == NULL){
+        free(group);
+        return NULL;
+    }
+    mem_pool_config_t conf;
+    memset(&conf, 0, sizeof(mem_pool_config_t));
+    if (config != NULL){
+        conf = *config;
+    }
+    group->num_pools = span;
+    group->first = span;
+    unsigned i = 0;
+    while (i < span){
+        if (online[i / MEM_NUMA_WORD_BITS] & (1UL << (i % MEM_NUMA_WORD_BITS))){
+            conf.numa = (nodes > 1) ? NUMA_BIND : NUMA_DEFAULT;
+            conf.numa_node = i;
+            if ((group->pools[i] = mem_pool_open_ex(size, policy, &conf)) == NULL){
+                mem_numa_group_close(group);
+                return NULL;
+            }
+            group->first = (group->first < i) ? group->first : i;
+        }
+        i += 1;
+    }
+    return group;
+}
+
+// The pool on the node the calling thread is running on. Threads can migrate, so it is
+// only a hint: the pool is right for as long as the scheduler leaves the thread there.
+pool_pt mem_numa_group_local(numa_group_pt group) {
+    if (group == NULL){
+        return NULL;
+    }
+    unsigned node = 0;
+#ifdef SYS_getcpu
+    unsigned cpu = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0){
+        node = 0;
+    }
+#endif
+    return (node < group->num_pools && group->pools[node] != NULL) ? group->pools[node] : group->pools[group->first];
+}
+
+alloc_status mem_numa_group_close(numa_group_pt group) {
+    if (group == NULL){
+        return ALLOC_FAIL;
+    }
+    alloc_status status = ALLOC_OK;
+    unsigned i = 0;
+    while (i < group->num_pools){
+        if (group->pools[i] != NULL && mem_pool_close(group->pools[i]) != ALLOC_OK){
+            status = ALLOC_NOT_FREED;
+        }
+        i += 1;
+    }
+    free(group->pools);
+    free(group);
+    return status;
+}
+
+// The open pool whose memory holds p, NULL if there is none.
+pool_pt mem_pool_of(const void *p) {
+    if (p == NULL){
+        return NULL;
+    }
+    unsigned i = _mem_range_ix_upper((const char*) p);
+    if (i == 0 || (size_t) ((const char*) p - pool_range_ix[i - 1].mem) >= pool_range_ix[i - 1].size){
+        return NULL;
+    }
+    return (pool_pt) pool_range_ix[i - 1].pool_mgr;
+}
+
+// Opens a group routing requests between the size ranges in classes (NULL: the default
+// table), ascending by max_size. Pools are opened as the requests come.
+mem_group_pt mem_group_open(const mem_group_class_t *classes, unsigned num_classes) {
+    if (pool_store == NULL){
+        return NULL;
+    }
+    if (classes == NULL){
+        classes = MEM_GROUP_DEFAULT_CLASSES;
+        num_classes = sizeof(MEM_GROUP_DEFAULT_CLASSES) / sizeof(mem_group_class_t);
+    }
+    if (num_classes > MEM_GROUP_CLASSES_MAX){
+        return NULL;
+    }
+    unsigned i = 0;
+    while (i < num_classes){//a pool too small for the class would never serve it.
+        if (classes[i].pool_size < classes[i].max_size || (i > 0 && classes[i].max_size <= classes[i - 1].max_size)){
+            return NULL;
+        }
+        i += 1;
+    }
+    mem_group_pt group = (mem_group_pt) calloc(1, sizeof(mem_group_t));
+    if (group == NULL){
+        return NULL;
+    }
+    group->members = (pool_pt*) malloc(sizeof(pool_pt) * MEM_GROUP_INIT_CAPACITY);
+    if (group->members == NULL){
+        free(group);
+        return NULL;
+    }
+    group->members_capacity = MEM_GROUP_INIT_CAPACITY;
+    memcpy(group->classes, classes, sizeof(mem_group_class_t) * num_classes);
+    group->num_classes = num_classes;
+    return group;
+}
+
+alloc_pt mem_group_alloc(mem_group_pt group, size_t size) {
+    if (group == NULL){
+        return NULL;
+    }
+    unsigned cls = 0;
+    while (cls < group->num_classes && size > group->classes[cls].max_size){
+        cls += 1;
+    }
+    pool_pt pool = NULL;
+    alloc_pt alloc = NULL;
+    if (cls == group->num_classes){
+        if ((pool = _mem_group_open_pool(group, cls, size)) == NULL){
+            return NULL;
+        }
+        if ((alloc = mem_new_alloc(pool, size)) == NULL){
+            group->num_dedicated -= 1;
+            mem_pool_close(pool);
+        }
+        return alloc;
+    }
+    if (group->newest[cls] != NULL){
+        alloc = mem_new_alloc(group->newest[cls], size);
+    }
+    unsigned i = 0;
+    while (alloc == NULL && i < group->num_members){//the older pools may have room again.
+        pool = group->members[i];
+        if (((pool_mgr_pt) pool)->group_cls == cls && pool != group->newest[cls]
+            && (alloc = mem_new_alloc(pool, size)) != NULL){
+            group->newest[cls] = pool;
+        }
+        i += 1;
+    }
+    if (alloc == NULL && (pool = _mem_group_open_pool(group, cls, size)) != NULL){
+        group->newest[cls] = pool;
+        alloc = mem_new_alloc(pool, size);
+    }
+    return alloc;
+}
+
+// Frees p, the alloc->mem of an allocation from any pool in the group.
+alloc_status mem_group_free(mem_group_pt group, void *p) {
+    if (group == NULL || p == NULL){
+        return ALLOC_FAIL;
+    }
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) mem_pool_of(p);
+    if (pool_mgr == NULL || pool_mgr->group != group){
+        return ALLOC_NOT_FREED;
+    }
+    alloc_status status = mem_del_ptr(&pool_mgr->pool, p);
+    if (status == ALLOC_OK && pool_mgr->group_cls == group->num_classes){
+        group->num_dedicated -= 1;
+        status = mem_pool_close(&pool_mgr->pool);
+    }
+    return status;
+}
+
+// Like mem_pool_close, fails with ALLOC_NOT_FREED while anything is still allocated.
+alloc_status mem_group_close(mem_group_pt group) {
+    if (group == NULL){
+        return ALLOC_FAIL;
+    }
+    if (group->num_dedicated != 0){
+        return ALLOC_NOT_FREED;
+    }
+    unsigned i = 0;
+    while (i < group->num_members){
+        if (group->members[i]->num_allocs != 0){
+            return ALLOC_NOT_FREED;
+        }
+        i += 1;
+    }
+    alloc_status status = ALLOC_OK;
+    i = 0;
+    while (i < group->num_members){
+        if (mem_pool_close(group->members[i]) != ALLOC_OK){
+            status = ALLOC_NOT_FREED;
+        }
+        i += 1;
+    }
+    free(group->members);
+    free(group);
+    return status;
+}
+
+pool_snapshot_pt mem_pool_snapshot(pool_pt pool) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr == NULL || pool_mgr->node_heap == NULL){
+        return NULL;
+    }
+    pool_snapshot_pt snap = (pool_snapshot_pt) calloc(1, sizeof(pool_snapshot_t));
+    if (snap == NULL){
+        return NULL;
+    }
+    _mem_lock(pool_mgr);
+    //the quick list isn't part of the snapshot, so it must be empty.
+    if (_mem_quick_flush(pool_mgr) != ALLOC_OK){
+        _mem_unlock(pool_mgr);
+        free(snap);
+        return NULL;
+    }
+    _mem_sync_gap_ix(pool_mgr);
+    snap->pool_mgr = pool_mgr;
+    snap->pool = pool_mgr->pool;
+    snap->node_heap = *pool_mgr->node_heap;
+    snap->used_nodes = pool_mgr->used_nodes;
+    snap->free_nodes = pool_mgr->free_nodes;
+    snap->nodes = (node_pt) malloc(sizeof(node_t) * pool_mgr->used_nodes);
+    snap->gap_ix.size = (size_t*) malloc(sizeof(size_t) * (pool_mgr->pool.num_gaps + 1));
+    snap->gap_ix.node = (unsigned*) malloc(sizeof(unsigned) * (pool_mgr->pool.num_gaps + 1));
+    snap->payload = (char*) malloc(pool_mgr->pool.alloc_size + 1);
+    if (snap->nodes == NULL || snap->gap_ix.size == NULL || snap->gap_ix.node == NULL || snap->payload == NULL){
+        _mem_unlock(pool_mgr);
+        mem_pool_snapshot_free(snap);
+        return NULL;
+    }
+    memcpy(snap->nodes, pool_mgr->node_heap->_nodes, sizeof(node_t) * pool_mgr->used_nodes);
+    memcpy(snap->gap_ix.size, pool_mgr->gap_ix.size, sizeof(size_t) * pool_mgr->pool.num_gaps);
+    memcpy(snap->gap_ix.node, pool_mgr->gap_ix.node, sizeof(unsigned) * pool_mgr->pool.num_gaps);
+    char *dst = snap->payload;
+    node_pt iter = node_begin(pool_mgr);
+    while (iter != NULL){
+        if (iter->allocated == 1){
+            memcpy(dst, node_get_mem(iter, pool_mgr->node_heap), node_get_size(iter, pool_mgr->node_heap));
+            dst += node_get_size(iter, pool_mgr->node_heap);
+        }
+        iter = node_get_next(iter, pool_mgr->node_heap);
+    }
+    _mem_unlock(pool_mgr);
+    return snap;
+}
+
+// Puts the pool back the way it was when snap was taken. Allocations made since then
+// are gone, and those freed since then are back, under the same alloc_pt as before.
+alloc_status mem_pool_restore(pool_pt pool, pool_snapshot_pt snap) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr == NULL || snap == NULL || snap->pool_mgr != pool_mgr){
+        return ALLOC_FAIL;
+    }
+    _mem_lock(pool_mgr);
+    node_head_pt head = pool_mgr->node_heap;
+    //the node heap and the gap index only grow, so the snapshot always fits.
+    if (snap->used_nodes > head->max_size || snap->pool.num_gaps > pool_mgr->gap_ix_capacity){
+        _mem_unlock(pool_mgr);
+        return ALLOC_FAIL;
+    }
+    //the node heap may have been reallocated (or the mapping moved) since.
+    ptrdiff_t node_delta = (char*) head->_nodes - (char*) snap->node_heap._nodes;
+    ptrdiff_t mem_delta = pool_mgr->pool.mem - snap->pool.mem;
+    memcpy(head->_nodes, snap->nodes, sizeof(node_t) * snap->used_nodes);
+    memcpy(pool_mgr->gap_ix.size, snap->gap_ix.size, sizeof(size_t) * snap->pool.num_gaps);
+    memcpy(pool_mgr->gap_ix.node, snap->gap_ix.node, sizeof(unsigned) * snap->pool.num_gaps);
+    size_t i = 0;
+    while (i < snap->used_nodes){
+#ifdef MEM_POOL_COMPACT_NODES
+        //links and offsets are relative.
+        (void) node_delta;
+        (void) mem_delta;
+#else
+        head->_nodes[i].next = _mem_rebase(head->_nodes[i].next, node_delta);
+        head->_nodes[i].prev = _mem_rebase(head->_nodes[i].prev, node_delta);
+        head->_nodes[i].alloc_record.mem = _mem_rebase(head->_nodes[i].alloc_record.mem, mem_delta);
+#endif
+        //the records aren't in the snapshot, refresh them from the nodes.
+        node_set_size(&head->_nodes[i], head, node_get_size(&head->_nodes[i], head));
+        node_set_mem(&head->_nodes[i], head, head->_nodes[i].used ? node_get_mem(&head->_nodes[i], head) : NULL);
+        head->_nodes[i].zeroed = 0;//gap bytes aren't in the snapshot
+        i += 1;
+    }
+    head->begin = _mem_rebase(snap->node_heap.begin, node_delta);
+    head->end = _mem_rebase(snap->node_heap.end, node_delta);
+    head->length = snap->node_heap.length;
+    pool_mgr->used_nodes = snap->used_nodes;
+    pool_mgr->free_nodes = snap->free_nodes;//the chain came back with the nodes.
+    pool_mgr->quick_count = 0;//the snapshot was taken with an empty quick list.
+    pool_mgr->gap_ix_stale = 0;//and a gap index in sync.
+    char *mem = pool_mgr->pool.mem;
+    pool_mgr->pool = snap->pool;
+    pool_mgr->pool.mem = mem;
+
+    _mem_ptr_ix_rebuild(pool_mgr);
+
+    const char *src = snap->payload;
+    node_pt iter = node_begin(pool_mgr);
+    while (iter != NULL){
+        if (iter->allocated == 1){
+            memcpy(node_get_mem(iter, head), src, node_get_size(iter, head));
+            src += node_get_size(iter, head);
+        }
+        iter = node_get_next(iter, head);
+    }
+    _mem_unlock(pool_mgr);
+    return ALLOC_OK;
+}
+
+// Rounds every request in pool up to the next of classes (ascending, at most
+// MEM_SIZE_CLASSES_MAX of them). Requests above the largest class are not rounded.
+// classes == NULL selects a jemalloc-style table: steps of 16 up to 128, then four
+// classes per doubling up to 16 KiB, so the worst-case waste is 25%. num_classes == 0
+// (with classes != NULL) turns rounding off. A gap smaller than min_gap bytes is not
+// split off an allocation, it's handed out with it.
+// Fewer, larger remainders keep the node heap and the gap index short, and freed
+// blocks of one class fit the next request of that class exactly.
+alloc_status mem_pool_set_size_classes(pool_pt pool, const size_t *classes, unsigned num_classes, size_t min_gap) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr == NULL || pool_mgr->tagged || pool_mgr->granule != 0 || num_classes > MEM_SIZE_CLASSES_MAX){
+        return ALLOC_FAIL;
+    }
+    size_t table[MEM_SIZE_CLASSES_MAX];
+    unsigned n = 0;
+    if (classes == NULL){
+        size_t c = 8;
+        while (c < 128){
+            table[n++] = c;
+            c = c < 16 ? 16 : c + 16;
+        }
+        size_t step = 0;
+        while (c <= 16 * 1024){
+            table[n++] = c;
+            if ((c & (c - 1)) == 0){//four classes from one power of two to the next.
+                step = c / 4;
+            }
+            c += step;
+        }
+        classes = table;
+        num_classes = n;
+    }
+    unsigned i = 1;
+    while (i < num_classes){
+        if (classes[i] <= classes[i - 1]){
+            return ALLOC_FAIL;
+        }
+        i += 1;
+    }
+    _mem_lock(pool_mgr);
+    memcpy(pool_mgr->size_classes, classes, sizeof(size_t) * num_classes);
+    pool_mgr->num_size_classes = num_classes;
+    pool_mgr->min_gap = min_gap;
+    _mem_unlock(pool_mgr);
+    return ALLOC_OK;
+}
+
+// Holds back up to threshold freed blocks (at most MEM_QUICK_CAPACITY) instead of
+// merging them with their neighbours. A request of exactly the size of one of them
+// gets it back without any splitting or gap index work. The held blocks are coalesced
+// when a request misses, when the list is full, and on close, compaction and snapshot.
+// threshold == 0 turns this off and coalesces what is held.
+alloc_status mem_pool_set_deferred_coalescing(pool_pt pool, unsigned threshold) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr == NULL || pool_mgr->tagged || pool_mgr->granule != 0 || threshold > MEM_QUICK_CAPACITY){
+        return ALLOC_FAIL;
+    }
+    _mem_lock(pool_mgr);
+    alloc_status status = ALLOC_OK;
+    if (threshold < pool_mgr->quick_count){
+        status = _mem_quick_flush(pool_mgr);
+    }
+    if (status == ALLOC_OK){
+        pool_mgr->quick_threshold = threshold;
+    }
+    _mem_unlock(pool_mgr);
+    return status;
+}
+
+// How far (in percent of the request) a gap may be larger than the request for
+// GOOD_FIT to take it without looking further. The default is MEM_GOOD_FIT_SLACK.
+alloc_status mem_pool_set_good_fit_slack(pool_pt pool, unsigned percent) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr == NULL){
+        return ALLOC_FAIL;
+    }
+    _mem_lock(pool_mgr);
+    pool_mgr->good_fit_slack = percent;
+    _mem_unlock(pool_mgr);
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_get_stats(pool_pt pool, pool_stats_pt stats) {
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    if (pool_mgr == NULL || stats == NULL){
+        return ALLOC_FAIL;
+    }
+    _mem_lock(pool_mgr);
+    *stats = pool_mgr->stats;
+    stats->quick_count = pool_mgr->quick_count;
+    _mem_unlock(pool_mgr);
+    return ALLOC_OK;
+}
+
+void mem_pool_snapshot_free(pool_snapshot_pt snap) {
+    if (snap == NULL){
+        return;
+    }
+    free(snap->nodes);
+    free(snap->gap_ix.size);
+    free(snap->gap_ix.node);
+    free(snap->payload);
+    free(snap);
+}
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// _mem_resize_pool_store
+/*
+    pre: There is a static pool_store with a pool_store_size and pool_store capacity.
+    There is constants MEM_POOL_STORE_FILL FACTOR, MEM_POOL_STORE_EXPAND_FACTOR
+
+*/
+static alloc_status _mem_resize_pool_store() {
+    // check if necessary
+    if (((float) pool_store_size / (float) pool_store_capacity)
+        < (float)MEM_POOL_STORE_FILL_FACTOR)
+    {
+        return ALLOC_OK;//and if it is not, inform that the allocation is okay.
+    }
+    unsigned new_capacity = ( unsigned ) ( pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR );
+    //Check the new capacity is greater than the pool store capacity, could be less because of overflow
+    if (new_capacity > pool_store_capacity)
+    {
+        pool_mgr_pt* verify_store = ( pool_mgr_pt* ) realloc(
+        ( void* ) pool_store ,
+        sizeof(pool_mgr_pt) * new_capacity
+        );
+        //realloc returns a void pointer just to say if pool_store has been allocated.
+        //This pointer can be null if it fails. Check that.
+        if (verify_store != NULL)
+        {
+            // don't forget to update capacity variables
+            pool_store_capacity = new_capacity;
+            pool_store = verify_store;
+            verify_store = NULL;
+            return ALLOC_OK;
+        }
+    }
+    return ALLOC_FAIL;
+}
+
+
+//If necessary to resize, resizes pool.
 //If unnecessary, return alloc_ok but does nothing else.
 //If pool_mgr malformed, returns Alloc_fail.
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
@@ -909,18 +2248,25 @@ static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
     if (pool_mgr == NULL || pool_mgr->node_heap == NULL){
         return ALLOC_FAIL;// if the pool mgr and the node heap don't exist, return Failure.
     }
+    if (pool_mgr->map != NULL){//fixed capacity, fine as long as there is a spare node.
+        return (pool_mgr->used_nodes < pool_mgr->total_nodes) ? ALLOC_OK : ALLOC_FAIL;
+    }
     //When I realized that the individual arrays and pools had sizes managed from external structures,
     // it made me kind of sad.
     if ( ((float) pool_mgr->used_nodes / (float) pool_mgr->total_nodes)
-        < (float)MEM_NODE_HEAP_FILL_FACTOR)
+        < pool_mgr->node_heap_fill_factor)
     {
         return ALLOC_OK;//and if it is not necessary to resize return alloc_ok
     }
-    unsigned new_capacity = ( unsigned ) ( pool_mgr->total_nodes * MEM_POOL_STORE_FILL_FACTOR );
+    unsigned new_capacity = ( unsigned ) ( pool_mgr->total_nodes * pool_mgr->node_heap_expand_factor );
     //Check the new capacity is greater than the pool store capacity, could be less because of overflow
-    if (new_capacity > pool_mgr->total_nodes){
+    if (new_capacity / pool_mgr->node_heap_expand_factor == pool_mgr->total_nodes
+#ifdef MEM_POOL_COMPACT_NODES
+        && new_capacity < MEM_NODE_NIL
+#endif
+        && new_capacity > pool_mgr->total_nodes){
         //realloc returns a void pointer just to say if pool_store has been allocated.
-        node_pt verify_store = resize_node_head(pool_mgr->node_heap, MEM_POOL_STORE_EXPAND_FACTOR);//done
+        node_pt verify_store = resize_node_head(pool_mgr->node_heap, pool_mgr->node_heap_expand_factor);//done
         //This pointer can be null if it fails. Check that.
         if (verify_store != NULL)
         {
@@ -937,36 +2283,45 @@ static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
 static alloc_status _mem_resize_gap_ix( pool_mgr_pt pool_mgr )
 {
         // check if necessary
-    if (pool_mgr == NULL || pool_mgr->gap_ix == NULL){
+    if (pool_mgr == NULL || pool_mgr->gap_ix.size == NULL){
         return ALLOC_FAIL;
     }
-    gap_pt gap_arr = pool_mgr->gap_ix;
+    if (pool_mgr->map != NULL){//fixed capacity, fine as long as there is a spare entry.
+        return (pool_mgr->pool.num_gaps < pool_mgr->gap_ix_capacity) ? ALLOC_OK : ALLOC_FAIL;
+    }
     //And then when I realized that instead of correctly being stored in a top facing structure,
     //but rather where hidden in multiple substructures, which breaks both re-usability and readability
     //I got offended.
     if (((float) pool_mgr->pool.num_gaps / (float) pool_mgr->gap_ix_capacity)
-        < (float)MEM_GAP_IX_FILL_FACTOR)
+        < pool_mgr->gap_ix_fill_factor)
     {
         return ALLOC_OK;//and if it is not, inform that the allocation is okay.
     }
-    unsigned new_capacity = ( unsigned ) ( pool_mgr->gap_ix_capacity * MEM_POOL_STORE_FILL_FACTOR );
+    unsigned new_capacity = ( unsigned ) ( pool_mgr->gap_ix_capacity * pool_mgr->gap_ix_expand_factor );
     //Check the new capacity is greater than the pool store capacity, could be less because of overflow
-    if (new_capacity > pool_mgr->gap_ix_capacity)
+    if (new_capacity / pool_mgr->gap_ix_expand_factor == pool_mgr->gap_ix_capacity
+        && new_capacity > pool_mgr->gap_ix_capacity)
     {
-        gap_pt verify_gap = ( gap_pt ) realloc(
-        ( void* ) gap_arr ,
-        sizeof(gap_pt) * MEM_GAP_IX_EXPAND_FACTOR
+        size_t *verify_size = ( size_t* ) realloc(
+        ( void* ) pool_mgr->gap_ix.size ,
+        sizeof(size_t) * new_capacity
         );
         //realloc returns a void pointer just to say if pool_store has been allocated.
         //This pointer can be null if it fails. Check that.
-        if (verify_gap != NULL)
+        if (verify_size != NULL)
         {
-            // don't forget to update capacity variables
-            pool_mgr->gap_ix_capacity = new_capacity;
-            pool_mgr->gap_ix = verify_gap;
-            verify_gap = NULL;
-            gap_arr = NULL;
-            return ALLOC_OK;
+            pool_mgr->gap_ix.size = verify_size;
+            unsigned *verify_node = ( unsigned* ) realloc(
+            ( void* ) pool_mgr->gap_ix.node ,
+            sizeof(unsigned) * new_capacity
+            );
+            if (verify_node != NULL)
+            {
+                // don't forget to update capacity variables
+                pool_mgr->gap_ix_capacity = new_capacity;
+                pool_mgr->gap_ix.node = verify_node;
+                return ALLOC_OK;
+            }
         }
     }
     return ALLOC_FAIL;
@@ -980,94 +2335,1389 @@ static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
     if ( _mem_resize_gap_ix(pool_mgr) != ALLOC_OK){
         return ALLOC_FAIL;
     }
+    // nothing reads it until it's synced, count the gap and leave the entries
+    if (pool_mgr->gap_ix_stale || _mem_gap_ix_lazy(pool_mgr)){
+        pool_mgr->gap_ix_stale = 1;
+        pool_mgr->pool.num_gaps += 1;
+        return ALLOC_OK;
+    }
 
-    // add the entry at the end
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = node;
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = size;
+    // make room at the entry's place in (size, address) order, and put it there
+    unsigned i = _mem_gap_lower_bound(pool_mgr, size, node_get_mem(node, pool_mgr->node_heap));
+    unsigned n = pool_mgr->pool.num_gaps;
+    memmove(&pool_mgr->gap_ix.size[i + 1], &pool_mgr->gap_ix.size[i], sizeof(size_t) * (n - i));
+    memmove(&pool_mgr->gap_ix.node[i + 1], &pool_mgr->gap_ix.node[i], sizeof(unsigned) * (n - i));
+    pool_mgr->gap_ix.size[i] = size;
+    pool_mgr->gap_ix.node[i] = _mem_node_offset(pool_mgr, node);
     // update metadata (num_gaps)
     pool_mgr->pool.num_gaps+=1;
-    // sort the gap index (call the function)
-    if(_mem_sort_gap_ix(pool_mgr) == ALLOC_OK){
-            return ALLOC_OK;
-    }
-    // check success
-    return ALLOC_FAIL;
+    return ALLOC_OK;
 }
 
+// size must be the size the gap was indexed with, its address is the tie-break.
 static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                             size_t size,
                                             node_pt node) {
+    if (pool_mgr->gap_ix_stale || _mem_gap_ix_lazy(pool_mgr)){
+        pool_mgr->gap_ix_stale = 1;
+        pool_mgr->pool.num_gaps -= 1;
+        return ALLOC_OK;
+    }
     // find the position of the node in the gap index
-    size_t i = 0;
-    char is_del = 0;
-    // loop from there sto the end of the array:
-    while ( i < pool_mgr->pool.num_gaps && is_del==0){
-        if(node == pool_mgr->gap_ix[i].node){
-            is_del = 1;
+    unsigned i = _mem_gap_lower_bound(pool_mgr, size, node_get_mem(node, pool_mgr->node_heap));
+    unsigned n = pool_mgr->pool.num_gaps;
+    if (i == n || pool_mgr->gap_ix.node[i] != _mem_node_offset(pool_mgr, node)){
+        return ALLOC_FAIL;
+    }
+    // pull the entries after it one position up
+    memmove(&pool_mgr->gap_ix.size[i], &pool_mgr->gap_ix.size[i + 1], sizeof(size_t) * (n - i - 1));
+    memmove(&pool_mgr->gap_ix.node[i], &pool_mgr->gap_ix.node[i + 1], sizeof(unsigned) * (n - i - 1));
+    // update metadata (num_gaps)
+    pool_mgr->pool.num_gaps -=1;
+    return ALLOC_OK;
+}
+
+// The first gap index entry that doesn't sort before a gap of size bytes at mem.
+static unsigned _mem_gap_lower_bound(pool_mgr_pt pool_mgr, size_t size, const char *mem) {
+    unsigned lo = 0, hi = pool_mgr->pool.num_gaps;
+    while (lo < hi){
+        unsigned mid = lo + (hi - lo) / 2;
+        if (pool_mgr->gap_ix.size[mid] < size
+            || (pool_mgr->gap_ix.size[mid] == size
+                && node_get_mem(_mem_gap_node(pool_mgr, mid), pool_mgr->node_heap) < mem)){
+            lo = mid + 1;
         }else{
-            i++;
+            hi = mid;
         }
     }
+    return lo;
+}
 
-    if(is_del){
-    //    pull the entries (i.e. copy over) one position up
-        while( i < pool_mgr->pool.num_gaps - 1){
-            pool_mgr->gap_ix[i].size = pool_mgr->gap_ix[i+1].size;
-            pool_mgr->gap_ix[i].node = pool_mgr->gap_ix[i+1].node;
-            i++;
+// The first gap index entry of at least size bytes, or num_gaps. A binary search
+// narrows it down to MEM_GAP_SCAN_WINDOW entries, which the scan kernel finishes.
+static unsigned _mem_gap_find(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned lo = 0, hi = pool_mgr->pool.num_gaps;
+    while (hi - lo > MEM_GAP_SCAN_WINDOW){
+        unsigned mid = lo + (hi - lo) / 2;
+        if (pool_mgr->gap_ix.size[mid] < size){
+            lo = mid + 1;
+        }else{
+            hi = mid;
         }
-        pool_mgr->gap_ix[pool_mgr->pool.num_gaps - 1].size = 0;
-        pool_mgr->gap_ix[pool_mgr->pool.num_gaps - 1].node = NULL;
-    // update metadata (num_gaps)
-        pool_mgr->pool.num_gaps -=1;
-
-        return ALLOC_OK;
     }
-    //    this effectively deletes the chosen node
-    // zero out the element at array end!
-    return ALLOC_FAIL;
+    assert(_mem_gap_scan_agrees(&pool_mgr->gap_ix.size[lo], hi - lo, size));
+    return lo + _mem_gap_scan(&pool_mgr->gap_ix.size[lo], hi - lo, size);
 }
 
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
+// Whether the policy picks gaps without the index, so it can be left to go stale.
+static int _mem_gap_ix_lazy(pool_mgr_pt pool_mgr) {
+    return pool_mgr->pool.policy == FIRST_FIT || pool_mgr->pool.policy == GOOD_FIT;
+}
 
-    // the new entry is at the end, so "bubble it up"
-    if (pool_mgr == NULL){
+// Rebuilds a stale gap index from the node list: the gaps are gathered in address
+// order and heap sorted by (size, address), in place, so it can't fail. _mem_add_to_gap_ix
+// kept the capacity ahead of num_gaps all along.
+static void _mem_sync_gap_ix(pool_mgr_pt pool_mgr) {
+    if (!pool_mgr->gap_ix_stale){
+        return;
+    }
+    node_head_pt head = pool_mgr->node_heap;
+    unsigned n = 0;
+    node_pt iter = node_begin(pool_mgr);
+    while (iter != NULL && n < pool_mgr->gap_ix_capacity){
+        if (iter->allocated == 0){
+            pool_mgr->gap_ix.node[n] = _mem_node_offset(pool_mgr, iter);
+            pool_mgr->gap_ix.size[n] = node_get_size(iter, head);
+            n += 1;
+        }
+        iter = node_get_next(iter, head);
+    }
+    assert(n == pool_mgr->pool.num_gaps);
+    unsigned i = n / 2;
+    while (i > 0){
+        i -= 1;
+        _mem_gap_sift_down(pool_mgr, i, n);
+    }
+    while (n > 1){
+        n -= 1;
+        size_t size = pool_mgr->gap_ix.size[0];
+        unsigned node = pool_mgr->gap_ix.node[0];
+        pool_mgr->gap_ix.size[0] = pool_mgr->gap_ix.size[n];
+        pool_mgr->gap_ix.node[0] = pool_mgr->gap_ix.node[n];
+        pool_mgr->gap_ix.size[n] = size;
+        pool_mgr->gap_ix.node[n] = node;
+        _mem_gap_sift_down(pool_mgr, 0, n);
+    }
+    pool_mgr->gap_ix_stale = 0;
+}
+
+// Whether gap index entry i sorts before entry j: smaller, or as big and lower in memory.
+static int _mem_gap_before(pool_mgr_pt pool_mgr, unsigned i, unsigned j) {
+    if (pool_mgr->gap_ix.size[i] != pool_mgr->gap_ix.size[j]){
+        return pool_mgr->gap_ix.size[i] < pool_mgr->gap_ix.size[j];
+    }
+    return node_get_mem(_mem_gap_node(pool_mgr, i), pool_mgr->node_heap)
+           < node_get_mem(_mem_gap_node(pool_mgr, j), pool_mgr->node_heap);
+}
+
+// Restores the max-heap order of the first n entries below entry i.
+static void _mem_gap_sift_down(pool_mgr_pt pool_mgr, unsigned i, unsigned n) {
+    while (2 * (size_t) i + 1 < n){
+        unsigned child = 2 * i + 1;
+        if (child + 1 < n && _mem_gap_before(pool_mgr, child, child + 1)){
+            child += 1;
+        }
+        if (!_mem_gap_before(pool_mgr, i, child)){
+            return;
+        }
+        size_t size = pool_mgr->gap_ix.size[i];
+        unsigned node = pool_mgr->gap_ix.node[i];
+        pool_mgr->gap_ix.size[i] = pool_mgr->gap_ix.size[child];
+        pool_mgr->gap_ix.node[i] = pool_mgr->gap_ix.node[child];
+        pool_mgr->gap_ix.size[child] = size;
+        pool_mgr->gap_ix.node[child] = node;
+        i = child;
+    }
+}
+
+// Merges the gap following gap into it. Both are re-indexed, since the size changes.
+static alloc_status _mem_merge_next_gap(pool_mgr_pt pool_mgr, node_pt gap) {
+    node_head_pt head = pool_mgr->node_heap;
+    node_pt del_me = node_get_next(gap, head);
+    if (del_me == NULL || del_me->allocated != 0 || gap->allocated != 0){
         return ALLOC_FAIL;
     }
-    size_t i = pool_mgr->pool.num_gaps;
-    if (i <= 1){
+    if (_mem_remove_from_gap_ix(pool_mgr, node_get_size(del_me, head), del_me) != ALLOC_OK
+        || _mem_remove_from_gap_ix(pool_mgr, node_get_size(gap, head), gap) != ALLOC_OK){
+        return ALLOC_FAIL;
+    }
+    node_set_size(gap, head, node_get_size(gap, head) + node_get_size(del_me, head));
+    gap->zeroed = gap->zeroed && del_me->zeroed;
+    _mem_unlink_node(pool_mgr, del_me);
+    return _mem_add_to_gap_ix(pool_mgr, node_get_size(gap, head), gap);
+}
+
+// Takes a node out of the list, marks it unused and puts it on the free node list.
+// Unlike remove_node, the node is trusted to be in the list, so there is no walk.
+static void _mem_unlink_node(pool_mgr_pt pool_mgr, node_pt node) {
+    node_head_pt head = pool_mgr->node_heap;
+    node_pt prev = node_get_prev(node, head);
+    node_pt next = node_get_next(node, head);
+    if (prev != NULL){
+        node_set_next(prev, head, next);
+    }else{
+        head->begin = next;
+    }
+    if (next != NULL){
+        node_set_prev(next, head, prev);
+    }
+    if (head->end == node){
+        head->end = prev;
+    }
+    head->length -= 1;
+    node_set_next(node, head, NULL);
+    node_set_prev(node, head, NULL);
+    node->used = 0;
+    node->allocated = 0;
+    node->zeroed = 0;
+    node_set_mem(node, head, NULL);
+    node_set_size(node, head, pool_mgr->free_nodes);//the size of an unused node links the free list
+    pool_mgr->free_nodes = (unsigned) (node - head->_nodes) + 1;
+}
+
+// Hands out the most recently freed block of exactly size bytes, if one is held back.
+static alloc_pt _mem_quick_take(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned i = pool_mgr->quick_count;
+    while (i > 0 && pool_mgr->quick_size[i - 1] != size){
+        i -= 1;
+    }
+    if (i == 0){
+        pool_mgr->stats.quick_misses += 1;
+        return NULL;
+    }
+    i -= 1;
+    node_pt node = &pool_mgr->node_heap->_nodes[pool_mgr->quick_node[i]];
+    node->allocated = 1;
+    if (_mem_ptr_ix_add(pool_mgr, node) != ALLOC_OK){
+        node->allocated = MEM_NODE_DEFERRED;
+        return NULL;
+    }
+    //keep the rest in the order they were freed, the oldest are flushed first.
+    memmove(&pool_mgr->quick_node[i], &pool_mgr->quick_node[i + 1], sizeof(unsigned) * (pool_mgr->quick_count - i - 1));
+    memmove(&pool_mgr->quick_size[i], &pool_mgr->quick_size[i + 1], sizeof(size_t) * (pool_mgr->quick_count - i - 1));
+    pool_mgr->quick_count -= 1;
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += size;
+    pool_mgr->stats.quick_hits += 1;
+    return node_get_alloc(node, pool_mgr->node_heap);
+}
+
+// Coalesces every block held back by deferred coalescing.
+static alloc_status _mem_quick_flush(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->quick_count == 0){
         return ALLOC_OK;
     }
-    //if size one, pool already sorted.
-    i=0;//make i point to one
-    size_t j = 0;
-    size_t top = pool_mgr->pool.num_gaps-1;
-    size_t swap;
-    node_pt swap_n;
-    while ( i < top){
-        j=0;
-        while (j < top - i ){
-        if(pool_mgr->gap_ix[j].size > pool_mgr->gap_ix[j+1].size){
-                swap = pool_mgr->gap_ix[j].size;
-                swap_n = pool_mgr->gap_ix[j].node;
-                pool_mgr->gap_ix[j].size = pool_mgr->gap_ix[j+1].size;
-                pool_mgr->gap_ix[j].node = pool_mgr->gap_ix[j+1].node;
-                pool_mgr->gap_ix[j+1].size = swap;
-                pool_mgr->gap_ix[j+1].node = swap_n;
+    unsigned i = 0;
+    while (i < pool_mgr->quick_count){
+        node_pt node = &pool_mgr->node_heap->_nodes[pool_mgr->quick_node[i]];
+        if (_mem_coalesce_node(pool_mgr, node) != ALLOC_OK){
+            //what is left stays deferred, and can still be flushed later.
+            memmove(&pool_mgr->quick_node[0], &pool_mgr->quick_node[i + 1], sizeof(unsigned) * (pool_mgr->quick_count - i - 1));
+            memmove(&pool_mgr->quick_size[0], &pool_mgr->quick_size[i + 1], sizeof(size_t) * (pool_mgr->quick_count - i - 1));
+            pool_mgr->quick_count -= i + 1;
+            return ALLOC_FAIL;
+        }
+        i += 1;
+    }
+    pool_mgr->quick_count = 0;
+    pool_mgr->stats.sweeps += 1;
+    return ALLOC_OK;
+}
+
+static node_pt _mem_gap_node(pool_mgr_pt pool_mgr, unsigned i) {
+    return &pool_mgr->node_heap->_nodes[pool_mgr->gap_ix.node[i]];
+}
+
+static unsigned _mem_node_offset(pool_mgr_pt pool_mgr, node_pt node) {
+    return (unsigned) (node - pool_mgr->node_heap->_nodes);
+}
+
+static unsigned _mem_gap_scan_scalar(const size_t *sizes, unsigned n, size_t size) {
+    unsigned i = 0;
+    while (i < n && sizes[i] < size){
+        i += 1;
+    }
+    return i;
+}
+
+#ifdef MEM_GAP_SCAN_X86
+// The vector kernels only have signed 64-bit compares, so both sides are biased by
+// the sign bit, and sizes[i] >= size is tested as sizes[i] > size - 1.
+__attribute__((target("sse4.2")))
+static unsigned _mem_gap_scan_sse42(const size_t *sizes, unsigned n, size_t size) {
+    if (size == 0){
+        return 0;
+    }
+    const __m128i bias = _mm_set1_epi64x((long long) 0x8000000000000000ULL);
+    const __m128i key = _mm_xor_si128(_mm_set1_epi64x((long long) (size - 1)), bias);
+    unsigned i = 0;
+    while (i + 4 <= n){
+        __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (sizes + i)), bias);
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (sizes + i + 2)), bias);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(a, key)))
+                   | _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(b, key))) << 2;
+        if (mask != 0){
+            return i + (unsigned) __builtin_ctz((unsigned) mask);
+        }
+        i += 4;
+    }
+    return i + _mem_gap_scan_scalar(sizes + i, n - i, size);
+}
+
+__attribute__((target("avx2")))
+static unsigned _mem_gap_scan_avx2(const size_t *sizes, unsigned n, size_t size) {
+    if (size == 0){
+        return 0;
+    }
+    const __m256i bias = _mm256_set1_epi64x((long long) 0x8000000000000000ULL);
+    const __m256i key = _mm256_xor_si256(_mm256_set1_epi64x((long long) (size - 1)), bias);
+    unsigned i = 0;
+    while (i + 8 <= n){
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (sizes + i)), bias);
+        __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (sizes + i + 4)), bias);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(a, key)))
+                   | _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(b, key))) << 4;
+        if (mask != 0){
+            return i + (unsigned) __builtin_ctz((unsigned) mask);
+        }
+        i += 8;
+    }
+    return i + _mem_gap_scan_scalar(sizes + i, n - i, size);
+}
+#endif
+
+static gap_scan_fn _mem_select_gap_scan(void) {
+#ifdef MEM_GAP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        return _mem_gap_scan_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")){
+        return _mem_gap_scan_sse42;
+    }
+#endif
+    return _mem_gap_scan_scalar;
+}
+
+#ifndef NDEBUG
+// Debug builds check every kernel this CPU runs against the scalar loop on each search.
+static int _mem_gap_scan_agrees(const size_t *sizes, unsigned n, size_t size) {
+    unsigned want = _mem_gap_scan_scalar(sizes, n, size);
+#ifdef MEM_GAP_SCAN_X86
+    if (__builtin_cpu_supports("sse4.2") && _mem_gap_scan_sse42(sizes, n, size) != want){
+        return 0;
+    }
+    if (__builtin_cpu_supports("avx2") && _mem_gap_scan_avx2(sizes, n, size) != want){
+        return 0;
+    }
+#endif
+    return _mem_gap_scan(sizes, n, size) == want;
+}
+#endif
+
+// Whether a gap of gap_size bytes (>= size) wastes no more than good_fit_slack percent of size.
+static int _mem_good_fit(pool_mgr_pt pool_mgr, size_t gap_size, size_t size) {
+    size_t slack = size / 100 * pool_mgr->good_fit_slack + size % 100 * pool_mgr->good_fit_slack / 100;
+    return gap_size - size <= slack;
+}
+
+// The smallest size class that holds size (lower bound), or size itself past the table.
+static size_t _mem_size_class(pool_mgr_pt pool_mgr, size_t size) {
+    unsigned lo = 0, hi = pool_mgr->num_size_classes;
+    while (lo < hi){
+        unsigned mid = (lo + hi) / 2;
+        if (pool_mgr->size_classes[mid] < size){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo < pool_mgr->num_size_classes ? pool_mgr->size_classes[lo] : size;
+}
+
+// memset() for small blocks. Large blocks are zeroed with non-temporal stores, so
+// the zeros go straight to memory instead of evicting the cache for data that the
+// caller won't read for a while.
+static void _mem_zero(char *mem, size_t size) {
+#ifdef __SSE2__
+    if (size >= MEM_ZERO_STREAM_THRESHOLD){
+        size_t head = (16 - ((uintptr_t) mem & 15)) & 15;
+        memset(mem, 0, head);
+        mem += head;
+        size -= head;
+        __m128i zero = _mm_setzero_si128();
+        char *end = mem + (size & ~(size_t) 63);
+        while (mem != end){
+            _mm_stream_si128((__m128i*) mem, zero);
+            _mm_stream_si128((__m128i*) (mem + 16), zero);
+            _mm_stream_si128((__m128i*) (mem + 32), zero);
+            _mm_stream_si128((__m128i*) (mem + 48), zero);
+            mem += 64;
+        }
+        _mm_sfence();//order the streaming stores before the unlock.
+        size &= 63;
+    }
+#endif
+    memset(mem, 0, size);
+}
+
+typedef struct _mem_touch {
+    char *mem;
+    size_t size;
+    size_t page;
+} mem_touch_t;
+
+// Writes a zero to every page, which faults it in without changing what it holds.
+static void *_mem_touch_pages(void *arg) {
+    mem_touch_t *touch = (mem_touch_t*) arg;
+    volatile char *mem = touch->mem;
+    size_t i = 0;
+    while (i < touch->size){
+        mem[i] = 0;
+        i += touch->page;
+    }
+    if (touch->size != 0){
+        mem[touch->size - 1] = 0;
+    }
+    return NULL;
+}
+
+// Faults in the (zeroed) pool memory. The kernel populates it in one call where it
+// can (MADV_POPULATE_WRITE); pools of a GiB and more are split between up to one
+// thread per CPU instead, since a single thread faulting them in is the bottleneck.
+static void _mem_prefault(char *mem, size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    mem_touch_t whole = { mem, size, (page > 0) ? (size_t) page : 4096 };
+    unsigned threads = 1;
+    if (size >= MEM_PREFAULT_PARALLEL_MIN && cpus > 1){
+        threads = ((unsigned long) cpus < MEM_PREFAULT_MAX_THREADS) ? (unsigned) cpus : MEM_PREFAULT_MAX_THREADS;
+    }
+    if (threads == 1){
+#ifdef MADV_POPULATE_WRITE
+        uintptr_t begin = ((uintptr_t) mem + whole.page - 1) & ~(uintptr_t) (whole.page - 1);
+        uintptr_t end = ((uintptr_t) mem + size) & ~(uintptr_t) (whole.page - 1);
+        if (begin < end && madvise((void*) begin, end - begin, MADV_POPULATE_WRITE) == 0){
+            //only the partial pages at either end are left.
+            mem[0] = 0;
+            mem[size - 1] = 0;
+            return;
+        }
+#endif
+        _mem_touch_pages(&whole);
+        return;
+    }
+    pthread_t tid[MEM_PREFAULT_MAX_THREADS];
+    mem_touch_t part[MEM_PREFAULT_MAX_THREADS];
+    char started[MEM_PREFAULT_MAX_THREADS];
+    size_t slice = (size / threads + whole.page - 1) & ~(whole.page - 1);
+    unsigned t = 0;
+    while (t < threads){
+        size_t from = slice * t;
+        part[t].mem = mem + from;
+        part[t].size = (from >= size) ? 0 : ((size - from < slice) ? size - from : slice);
+        part[t].page = whole.page;
+        started[t] = (t != 0 && pthread_create(&tid[t], NULL, _mem_touch_pages, &part[t]) == 0);
+        t += 1;
+    }
+    t = 0;
+    while (t < threads){//this thread takes the first slice, and any a thread couldn't be started for.
+        if (started[t]){
+            pthread_join(tid[t], NULL);
+        }else{
+            _mem_touch_pages(&part[t]);
+        }
+        t += 1;
+    }
+}
+
+// Opens a pool for class cls (a dedicated one of size bytes past the last class),
+// owned by the group.
+static pool_pt _mem_group_open_pool(mem_group_pt group, unsigned cls, size_t size) {
+    if (cls < group->num_classes && group->num_members == group->members_capacity){
+        pool_pt *members = (pool_pt*) realloc(group->members,
+                sizeof(pool_pt) * group->members_capacity * MEM_EXPAND_FACTOR);
+        if (members == NULL){
+            return NULL;
+        }
+        group->members = members;
+        group->members_capacity *= MEM_EXPAND_FACTOR;
+    }
+    pool_pt pool = NULL;
+    if (cls == group->num_classes){
+        pool = mem_pool_open(size, FIRST_FIT);
+    }else if (group->classes[cls].granule != 0){
+        pool = mem_pool_open_bitmap(group->classes[cls].pool_size, group->classes[cls].granule, group->classes[cls].policy);
+    }else if ((pool = mem_pool_open(group->classes[cls].pool_size, group->classes[cls].policy)) != NULL){
+        mem_pool_set_size_classes(pool, NULL, 0, 0);
+    }
+    if (pool == NULL){
+        return NULL;
+    }
+    ((pool_mgr_pt) pool)->group = group;
+    ((pool_mgr_pt) pool)->group_cls = cls;
+    if (cls == group->num_classes){
+        group->num_dedicated += 1;
+    }else{
+        group->members[group->num_members] = pool;
+        group->num_members += 1;
+    }
+    return pool;
+}
+
+// Fills online with a mask of the NUMA nodes online and returns how many there are,
+// span is the highest + 1. Node 0 alone if the kernel doesn't say.
+static unsigned _mem_numa_online(unsigned long *online, unsigned *span) {
+    memset(online, 0, sizeof(unsigned long) * (MEM_NUMA_MAX_NODES / MEM_NUMA_WORD_BITS));
+    unsigned nodes = 0;
+    *span = 0;
+    FILE *file = fopen("/sys/devices/system/node/online", "r");
+    if (file != NULL){
+        unsigned from = 0, to = 0;
+        int c = 0;
+        while (fscanf(file, "%u", &from) == 1){//a list of ranges: 0-3,8-11
+            to = from;
+            if ((c = fgetc(file)) == '-' && fscanf(file, "%u", &to) == 1){
+                c = fgetc(file);
             }
-            j+=1;
+            while (from <= to && from < MEM_NUMA_MAX_NODES){
+                online[from / MEM_NUMA_WORD_BITS] |= 1UL << (from % MEM_NUMA_WORD_BITS);
+                nodes += 1;
+                *span = from + 1;
+                from += 1;
+            }
+            if (c != ','){
+                break;
+            }
+        }
+        fclose(file);
+    }
+    if (nodes == 0){
+        online[0] = 1;
+        nodes = 1;
+        *span = 1;
+    }
+    return nodes;
+}
+
+static alloc_status _mem_numa_place(char *mem, size_t size, numa_placement placement, unsigned node) {
+    unsigned long online[MEM_NUMA_MAX_NODES / MEM_NUMA_WORD_BITS];
+    unsigned span = 0;
+    unsigned nodes = _mem_numa_online(online, &span);
+    if (placement == NUMA_BIND
+        && (node >= span || !(online[node / MEM_NUMA_WORD_BITS] & (1UL << (node % MEM_NUMA_WORD_BITS))))){
+        return ALLOC_FAIL;
+    }
+    if (placement == NUMA_DEFAULT || nodes < 2){
+        return ALLOC_OK;
+    }
+#ifdef SYS_mbind
+    unsigned long mask[MEM_NUMA_MAX_NODES / MEM_NUMA_WORD_BITS];
+    if (placement == NUMA_BIND){
+        memset(mask, 0, sizeof(mask));
+        mask[node / MEM_NUMA_WORD_BITS] = 1UL << (node % MEM_NUMA_WORD_BITS);
+    }else{//interleaved over the nodes online, skipping the holes.
+        memcpy(mask, online, sizeof(mask));
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t align = (page > 0) ? (uintptr_t) page : 4096;
+    uintptr_t begin = ((uintptr_t) mem + align - 1) & ~(align - 1);
+    uintptr_t end = ((uintptr_t) mem + size) & ~(align - 1);
+    if (begin < end){
+        //pages calloc already touched are moved over as well.
+        syscall(SYS_mbind, (void*) begin, end - begin,
+                (placement == NUMA_BIND) ? MEM_MPOL_BIND : MEM_MPOL_INTERLEAVE,
+                mask, (unsigned long) span + 1, MEM_MPOL_MF_MOVE);
+    }
+#endif
+    return ALLOC_OK;
+}
+
+// Exchanges the list positions of node and node->next: P <-> A <-> B <-> N becomes P <-> B <-> A <-> N.
+static void _mem_swap_with_next(node_head_pt head, node_pt node) {
+    node_pt a = node;
+    node_pt b = node_get_next(node, head);
+    if (b == NULL){
+        return;
+    }
+    node_pt p = node_get_prev(a, head);
+    node_pt n = node_get_next(b, head);
+    if (p != NULL){
+        node_set_next(p, head, b);
+    }else{
+        head->begin = b;
+    }
+    if (n != NULL){
+        node_set_prev(n, head, a);
+    }
+    if (head->end == b){
+        head->end = a;
+    }
+    node_set_prev(b, head, p);
+    node_set_next(b, head, a);
+    node_set_prev(a, head, b);
+    node_set_next(a, head, n);
+}
+
+// Finds a free slot in the pool store, growing it if necessary.
+static alloc_status _mem_reserve_pool_store_slot(size_t *slot) {
+    size_t insertion_point = 0;
+    size_t original_size = pool_store_size;
+    //finds the first pool address in the pool store that is non-null
+    //In theory, there should only be a small number of possible pools
+    //Or if there are a great number of pools, finding them individually is preferable
+    //to running out of them prematurely because you don't recycle them.
+    while (insertion_point < pool_store_size && pool_store[insertion_point] != NULL){
+        insertion_point += 1;
+    }
+    if (insertion_point >= pool_store_size){
+        insertion_point = pool_store_size;
+        pool_store_size+=1;
+    }
+    if( _mem_resize_pool_store() == ALLOC_FAIL){
+        pool_store_size= original_size;//correct pool size.
+        return ALLOC_FAIL;
+    }
+    if (pool_range_count == pool_range_capacity){//room for the pool's range, added once it's open.
+        unsigned new_capacity = (pool_range_capacity == 0) ? MEM_POOL_STORE_INIT_CAPACITY
+                                                           : pool_range_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+        pool_range_pt ranges = (pool_range_pt) realloc(pool_range_ix, sizeof(pool_range_t) * new_capacity);
+        if (ranges == NULL){
+            pool_store_size = original_size;
+            return ALLOC_FAIL;
+        }
+        pool_range_ix = ranges;
+        pool_range_capacity = new_capacity;
+    }
+    pool_store[insertion_point] = NULL;
+    *slot = insertion_point;
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_remove_from_pool_store(pool_mgr_pt pool_mgr) {
+    size_t i = 0;
+    while (i < pool_store_size){
+        if(pool_store[i] == pool_mgr){
+            pool_store[i] = NULL;
+            _mem_range_ix_remove(pool_mgr);
+            return ALLOC_OK;
         }
         i+=1;
     }
+    return ALLOC_FAIL;
+}
 
+// The number of ranges starting at or below mem.
+static unsigned _mem_range_ix_upper(const char *mem) {
+    unsigned lo = 0, hi = pool_range_count;
+    while (lo < hi){
+        unsigned mid = lo + (hi - lo) / 2;
+        if (pool_range_ix[mid].mem <= mem){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
+// _mem_reserve_pool_store_slot made the room.
+static void _mem_range_ix_add(pool_mgr_pt pool_mgr) {
+    unsigned i = _mem_range_ix_upper(pool_mgr->pool.mem);
+    memmove(&pool_range_ix[i + 1], &pool_range_ix[i], sizeof(pool_range_t) * (pool_range_count - i));
+    pool_range_ix[i].mem = pool_mgr->pool.mem;
+    pool_range_ix[i].size = pool_mgr->pool.total_size;
+    pool_range_ix[i].pool_mgr = pool_mgr;
+    pool_range_count += 1;
+}
 
-    //_print_gap_ix(pool_mgr, 'a');
+// Found by pool_mgr, since the pool memory may already be gone.
+static void _mem_range_ix_remove(pool_mgr_pt pool_mgr) {
+    unsigned i = 0;
+    while (i < pool_range_count && pool_range_ix[i].pool_mgr != pool_mgr){
+        i += 1;
+    }
+    if (i < pool_range_count){
+        memmove(&pool_range_ix[i], &pool_range_ix[i + 1], sizeof(pool_range_t) * (pool_range_count - i - 1));
+        pool_range_count -= 1;
+    }
+}
+
+// Flushes a mapped pool to its file and detaches it, allocations and all.
+static alloc_status _mem_unmap_pool(pool_mgr_pt pool_mgr) {
+    pool_map_pt map = pool_mgr->map;
+    if (_mem_remove_from_pool_store(pool_mgr) != ALLOC_OK){
+        return ALLOC_NOT_FREED;
+    }
+    size_t map_size = map->map_size;
+    if (msync((void*) map, map_size, MS_SYNC) != 0){
+        perror("mem_pool_close");
+    }
+    if (munmap((void*) map, map_size) != 0){
+        return ALLOC_FAIL;
+    }
+    return ALLOC_OK;
+}
+
+static void *_mem_rebase(void *p, ptrdiff_t delta) {
+    return (p == NULL) ? NULL : (void*) ((char*) p + delta);
+}
+
+// Moves every pointer of a mapped pool by delta, after the mapping had to be placed elsewhere.
+static void _mem_rebase_mapped(pool_mgr_pt pool_mgr, ptrdiff_t delta) {
+    pool_mgr->map = _mem_rebase(pool_mgr->map, delta);
+    pool_mgr->pool.mem = _mem_rebase(pool_mgr->pool.mem, delta);
+    pool_mgr->node_heap = _mem_rebase(pool_mgr->node_heap, delta);
+    pool_mgr->gap_ix.size = _mem_rebase(pool_mgr->gap_ix.size, delta);
+    pool_mgr->gap_ix.node = _mem_rebase(pool_mgr->gap_ix.node, delta);
+    pool_mgr->ptr_ix = _mem_rebase(pool_mgr->ptr_ix, delta);
+    node_head_pt head = pool_mgr->node_heap;
+    head->_nodes = _mem_rebase(head->_nodes, delta);
+    head->begin = _mem_rebase(head->begin, delta);
+    head->end = _mem_rebase(head->end, delta);
+    head->_records = _mem_rebase(head->_records, delta);
+    size_t i = 0;
+    while (i < MEM_MAP_CAPACITY / MEM_RECORD_SLAB){
+        head->_records[i] = _mem_rebase(head->_records[i], delta);
+        i += 1;
+    }
+#ifdef MEM_POOL_COMPACT_NODES
+    head->mem = _mem_rebase(head->mem, delta);
+#endif
     i = 0;
+    while (i < pool_mgr->used_nodes){
+#ifndef MEM_POOL_COMPACT_NODES
+        head->_nodes[i].next = _mem_rebase(head->_nodes[i].next, delta);
+        head->_nodes[i].prev = _mem_rebase(head->_nodes[i].prev, delta);
+        head->_nodes[i].alloc_record.mem = _mem_rebase(head->_nodes[i].alloc_record.mem, delta);
+#endif
+        node_record(head, i)->mem = _mem_rebase(node_record(head, i)->mem, delta);
+        i += 1;
+    }
+}
+
+static size_t _mem_align_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+// Copies the header of the pool in fd into hdr once its creator has published it,
+// waiting up to MEM_MAP_ATTACH_TIMEOUT_MS. The creator stores the magic last, with
+// release order, so a magic read back with acquire order means the pool is complete.
+// 0 on timeout, or if fd holds something other than a pool.
+static char _mem_map_wait_header(int fd, pool_map_t *hdr) {
+    struct timespec tick = {0, 1000000};
+    unsigned waited = 0;
+    while (1){
+        struct stat st;
+        if (fstat(fd, &st) != 0){
+            return 0;
+        }
+        if ((size_t) st.st_size >= sizeof(pool_map_t)){
+            pool_map_pt map = (pool_map_pt) mmap(NULL, sizeof(pool_map_t), PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED){
+                return 0;
+            }
+            unsigned long magic = __atomic_load_n(&map->magic, __ATOMIC_ACQUIRE);
+            if (magic != 0){
+                memcpy(hdr, map, sizeof(pool_map_t));
+            }
+            munmap(map, sizeof(pool_map_t));
+            if (magic != 0){
+                return magic == MEM_MAP_MAGIC;
+            }
+        }
+        if (waited >= MEM_MAP_ATTACH_TIMEOUT_MS){
+            return 0;
+        }
+        nanosleep(&tick, NULL);
+        waited += 1;
+    }
+}
+
+// Maps the pool kept in fd, which is closed before returning. is_new says this
+// process created fd and gives it a fresh pool; otherwise it waits for the creator
+// to finish and attaches. shared pools must land at their original address, because
+// other processes are using the pointers in them; a private file pool is moved instead.
+static pool_pt _mem_pool_open_mapped(int fd, char shared, char is_new, size_t size, alloc_policy policy) {
+    //the offsets of every part of the mapping.
+    size_t mgr_off = _mem_align_up(sizeof(pool_map_t), MEM_MAP_ALIGN);
+    size_t head_off = _mem_align_up(mgr_off + sizeof(pool_mgr_t), MEM_MAP_ALIGN);
+    size_t nodes_off = _mem_align_up(head_off + sizeof(node_head), MEM_MAP_ALIGN);
+    size_t records_off = _mem_align_up(nodes_off + sizeof(node_t) * MEM_MAP_CAPACITY, MEM_MAP_ALIGN);
+    size_t slabs_off = _mem_align_up(records_off + sizeof(alloc_t) * MEM_MAP_CAPACITY, MEM_MAP_ALIGN);
+    size_t gaps_off = _mem_align_up(slabs_off + sizeof(alloc_pt) * (MEM_MAP_CAPACITY / MEM_RECORD_SLAB), MEM_MAP_ALIGN);
+    size_t gap_nodes_off = _mem_align_up(gaps_off + sizeof(size_t) * MEM_MAP_CAPACITY, MEM_MAP_ALIGN);
+    size_t ptrs_off = _mem_align_up(gap_nodes_off + sizeof(unsigned) * MEM_MAP_CAPACITY, MEM_MAP_ALIGN);
+    size_t mem_off = _mem_align_up(ptrs_off + sizeof(ptr_ix_t) * 2 * MEM_MAP_CAPACITY, MEM_MAP_ALIGN);
+    size_t map_size = mem_off + size;
+
+    //read the header of an existing pool to find where it wants to be mapped.
+    char *hint = NULL;
+    if (!is_new){
+        pool_map_t hdr;
+        struct stat st;
+        if (!_mem_map_wait_header(fd, &hdr) || fstat(fd, &st) != 0
+            || hdr.version != MEM_MAP_VERSION
+            || hdr.capacity != MEM_MAP_CAPACITY || hdr.map_size != map_size
+            || hdr.total_size != size || hdr.policy != policy
+            || hdr.shared != (unsigned) shared
+            || (size_t) st.st_size != map_size){
+            close(fd);
+            return NULL;
+        }
+        hint = hdr.base;
+    }else if (ftruncate(fd, (off_t) map_size) != 0){
+        close(fd);
+        return NULL;
+    }
+    size_t insertion_point = 0;
+    if (_mem_reserve_pool_store_slot(&insertion_point) != ALLOC_OK){
+        close(fd);
+        return NULL;
+    }
+    int flags = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+    if (hint != NULL){
+        flags |= MAP_FIXED_NOREPLACE;
+    }
+#endif
+    char *base = (char*) mmap(hint, map_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+#ifdef MAP_FIXED_NOREPLACE
+    if (base == MAP_FAILED && hint != NULL && !shared){//the address is taken, settle for any.
+        base = (char*) mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+#endif
+    close(fd);//the mapping keeps the object open.
+    if (base == MAP_FAILED){
+        perror("mem_pool_open_mapped");
+        return NULL;
+    }
+
+    pool_map_pt map = (pool_map_pt) base;
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) (base + mgr_off);
+    if (is_new){
+        map->version = MEM_MAP_VERSION;
+        map->capacity = MEM_MAP_CAPACITY;
+        map->base = base;
+        map->map_size = map_size;
+        map->total_size = size;
+        map->policy = policy;
+        map->shared = (unsigned) shared;
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&map->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        pool_mgr->pool.mem = base + mem_off;
+        pool_mgr->pool.total_size = size;
+        pool_mgr->pool.alloc_size = 0;
+        pool_mgr->pool.num_allocs = 0;
+        pool_mgr->pool.num_gaps = 1;
+        pool_mgr->pool.policy = policy;
+        pool_mgr->node_heap = (node_head_pt) (base + head_off);
+        pool_mgr->node_heap->_nodes = (node_pt) (base + nodes_off);
+        pool_mgr->node_heap->_records = (alloc_pt*) (base + slabs_off);
+        size_t s = 0;
+        while (s < MEM_MAP_CAPACITY / MEM_RECORD_SLAB){
+            pool_mgr->node_heap->_records[s] = (alloc_pt) (base + records_off) + s * MEM_RECORD_SLAB;
+            s += 1;
+        }
+#ifdef MEM_POOL_COMPACT_NODES
+        pool_mgr->node_heap->mem = pool_mgr->pool.mem;
+#endif
+        pool_mgr->node_heap->length = 0;
+        pool_mgr->node_heap->max_size = MEM_MAP_CAPACITY;
+        pool_mgr->node_heap->begin = NULL;
+        pool_mgr->node_heap->end = NULL;
+        pool_mgr->gap_ix.size = (size_t*) (base + gaps_off);
+        pool_mgr->gap_ix.node = (unsigned*) (base + gap_nodes_off);
+        pool_mgr->gap_ix_capacity = MEM_MAP_CAPACITY;
+        pool_mgr->gap_ix_stale = 0;
+        pool_mgr->total_nodes = MEM_MAP_CAPACITY;
+        pool_mgr->used_nodes = 1;
+        pool_mgr->free_nodes = 0;
+        pool_mgr->node_heap_fill_factor = MEM_NODE_HEAP_FILL_FACTOR;//unused, the capacity is fixed
+        pool_mgr->node_heap_expand_factor = MEM_NODE_HEAP_EXPAND_FACTOR;
+        pool_mgr->gap_ix_fill_factor = MEM_GAP_IX_FILL_FACTOR;
+        pool_mgr->gap_ix_expand_factor = MEM_GAP_IX_EXPAND_FACTOR;
+        pool_mgr->map = map;
+        pool_mgr->tagged = 0;
+        pool_mgr->granule = 0;
+        pool_mgr->num_size_classes = 0;
+        pool_mgr->min_gap = 0;
+        pool_mgr->quick_threshold = 0;
+        pool_mgr->quick_count = 0;
+        memset(&pool_mgr->stats, 0, sizeof(pool_stats_t));
+        pool_mgr->good_fit_slack = MEM_GOOD_FIT_SLACK;
+        pool_mgr->group = NULL;
+        _mem_ptr_ix_init(pool_mgr, (ptr_ix_pt) (base + ptrs_off), 2 * MEM_MAP_CAPACITY);
+
+        node_list_insert( node_from_offset(pool_mgr->node_heap, 0), pool_mgr->node_heap, NULL);
+        node_begin(pool_mgr)->used = 1;
+        node_begin(pool_mgr)->allocated = 0;
+        node_begin(pool_mgr)->zeroed = 1;//ftruncate() fills with zeros
+        node_set_mem(node_begin(pool_mgr), pool_mgr->node_heap, pool_mgr->pool.mem);
+        node_set_size(node_begin(pool_mgr), pool_mgr->node_heap, size);
+        pool_mgr->gap_ix.node[0] = 0;
+        pool_mgr->gap_ix.size[0] = size;
+        //written last, so a process attaching early doesn't accept a half-made pool.
+        __atomic_store_n(&map->magic, MEM_MAP_MAGIC, __ATOMIC_RELEASE);
+    }else if (base != map->base){
+        //refuse to move a mapping this process already has attached somewhere else,
+        //or one that other processes are using.
+        size_t i = 0;
+        char in_use = shared;
+        while (i < pool_store_size && !in_use){
+            if (pool_store[i] != NULL && pool_store[i]->map != NULL
+                && (char*) pool_store[i]->map == map->base){
+                in_use = 1;
+            }
+            i += 1;
+        }
+        if (in_use){
+            munmap(base, map_size);
+            return NULL;
+        }
+        _mem_rebase_mapped(pool_mgr, base - map->base);
+        map->base = base;
+    }
+    pool_store[insertion_point] = pool_mgr;
+    _mem_range_ix_add(pool_mgr);
+    return (pool_pt) pool_mgr;
+}
+
+// Shared pools are locked around every operation, other pools are left alone.
+static void _mem_lock(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->map != NULL && pool_mgr->map->shared){
+        if (pthread_mutex_lock(&pool_mgr->map->lock) == EOWNERDEAD){
+            //the holder died, take the pool over as it was left.
+            pthread_mutex_consistent(&pool_mgr->map->lock);
+        }
+    }
+}
+
+static void _mem_unlock(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->map != NULL && pool_mgr->map->shared){
+        pthread_mutex_unlock(&pool_mgr->map->lock);
+    }
+}
+
+static unsigned _mem_ptr_ix_home(size_t key, unsigned capacity) {
+    return (unsigned) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+static alloc_status _mem_ptr_ix_init(pool_mgr_pt pool_mgr, ptr_ix_pt entries, unsigned capacity) {
+    if (entries == NULL){
+        return ALLOC_FAIL;
+    }
+    memset(entries, 0, sizeof(ptr_ix_t) * capacity);
+    pool_mgr->ptr_ix = entries;
+    pool_mgr->ptr_ix_capacity = capacity;
+    pool_mgr->ptr_ix_count = 0;
+    return ALLOC_OK;
+}
+
+// Puts an entry for the allocation starting at node's mem.
+static alloc_status _mem_ptr_ix_add(pool_mgr_pt pool_mgr, node_pt node) {
+    return _mem_ptr_ix_put(pool_mgr, node_get_mem(node, pool_mgr->node_heap),
+                           (size_t) (node - pool_mgr->node_heap->_nodes));
+}
+
+// Maps the payload at mem to value (a node heap offset, or a record number in bitmap
+// pools), growing the table on the heap if needed.
+static alloc_status _mem_ptr_ix_put(pool_mgr_pt pool_mgr, char *mem, size_t value) {
+    if ((float) (pool_mgr->ptr_ix_count + 1) / (float) pool_mgr->ptr_ix_capacity
+        > (float) MEM_PTR_IX_FILL_FACTOR){
+        if (pool_mgr->map != NULL){//sized for every node up front, can't grow.
+            return ALLOC_FAIL;
+        }
+        ptr_ix_pt old = pool_mgr->ptr_ix;
+        unsigned old_capacity = pool_mgr->ptr_ix_capacity;
+        unsigned capacity = old_capacity * 2;
+        if (capacity < old_capacity
+            || _mem_ptr_ix_init(pool_mgr, (ptr_ix_pt) malloc(sizeof(ptr_ix_t) * capacity), capacity) != ALLOC_OK){
+            return ALLOC_FAIL;
+        }
+        unsigned u = 0;
+        while (u < old_capacity){
+            if (old[u].key != 0){
+                unsigned slot = _mem_ptr_ix_home(old[u].key, capacity);
+                while (pool_mgr->ptr_ix[slot].key != 0){
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                pool_mgr->ptr_ix[slot] = old[u];
+                pool_mgr->ptr_ix_count += 1;
+            }
+            u += 1;
+        }
+        free(old);
+    }
+    size_t key = (size_t) (mem - pool_mgr->pool.mem) + 1;
+    unsigned mask = pool_mgr->ptr_ix_capacity - 1;
+    unsigned slot = _mem_ptr_ix_home(key, pool_mgr->ptr_ix_capacity);
+    while (pool_mgr->ptr_ix[slot].key != 0 && pool_mgr->ptr_ix[slot].key != key){
+        slot = (slot + 1) & mask;
+    }
+    if (pool_mgr->ptr_ix[slot].key == 0){
+        pool_mgr->ptr_ix_count += 1;
+    }
+    pool_mgr->ptr_ix[slot].key = key;
+    pool_mgr->ptr_ix[slot].node = value;
+    return ALLOC_OK;
+}
+
+static unsigned _mem_ptr_ix_slot(pool_mgr_pt pool_mgr, char *mem, size_t *key) {
+    *key = (size_t) (mem - pool_mgr->pool.mem) + 1;
+    unsigned mask = pool_mgr->ptr_ix_capacity - 1;
+    unsigned slot = _mem_ptr_ix_home(*key, pool_mgr->ptr_ix_capacity);
+    while (pool_mgr->ptr_ix[slot].key != 0 && pool_mgr->ptr_ix[slot].key != *key){
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static alloc_status _mem_ptr_ix_get(pool_mgr_pt pool_mgr, char *mem, size_t *value) {
+    if (mem < pool_mgr->pool.mem || mem >= pool_mgr->pool.mem + pool_mgr->pool.total_size){
+        return ALLOC_FAIL;
+    }
+    size_t key;
+    unsigned slot = _mem_ptr_ix_slot(pool_mgr, mem, &key);
+    if (pool_mgr->ptr_ix[slot].key != key){
+        return ALLOC_FAIL;
+    }
+    *value = pool_mgr->ptr_ix[slot].node;
+    return ALLOC_OK;
+}
+
+static node_pt _mem_ptr_ix_find(pool_mgr_pt pool_mgr, char *mem) {
+    size_t offset;
+    if (_mem_ptr_ix_get(pool_mgr, mem, &offset) != ALLOC_OK){
+        return NULL;
+    }
+    node_pt node = &pool_mgr->node_heap->_nodes[offset];
+    return (node->used == 1 && node->allocated == 1) ? node : NULL;
+}
+
+// Deletes by shifting the rest of the probe run back, so no tombstones are needed.
+static void _mem_ptr_ix_remove(pool_mgr_pt pool_mgr, char *mem) {
+    size_t key;
+    unsigned i = _mem_ptr_ix_slot(pool_mgr, mem, &key);
+    if (pool_mgr->ptr_ix[i].key != key){
+        return;
+    }
+    unsigned mask = pool_mgr->ptr_ix_capacity - 1;
+    unsigned j = i;
+    while (1){
+        j = (j + 1) & mask;
+        if (pool_mgr->ptr_ix[j].key == 0){
+            break;
+        }
+        unsigned home = _mem_ptr_ix_home(pool_mgr->ptr_ix[j].key, pool_mgr->ptr_ix_capacity);
+        //move j back into the hole at i unless its home lies cyclically in (i, j].
+        char stays = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays){
+            pool_mgr->ptr_ix[i] = pool_mgr->ptr_ix[j];
+            i = j;
+        }
+    }
+    pool_mgr->ptr_ix[i].key = 0;
+    pool_mgr->ptr_ix[i].node = 0;
+    pool_mgr->ptr_ix_count -= 1;
+}
+
+// Refills the table from the node list, after the nodes were replaced wholesale.
+static alloc_status _mem_ptr_ix_rebuild(pool_mgr_pt pool_mgr) {
+    memset(pool_mgr->ptr_ix, 0, sizeof(ptr_ix_t) * pool_mgr->ptr_ix_capacity);
+    pool_mgr->ptr_ix_count = 0;
+    node_pt iter = node_begin(pool_mgr);
+    while (iter != NULL){
+        if (iter->allocated == 1 && _mem_ptr_ix_add(pool_mgr, iter) != ALLOC_OK){
+            return ALLOC_FAIL;
+        }
+        iter = node_get_next(iter, pool_mgr->node_heap);
+    }
+    return ALLOC_OK;
+}
+
+/*
+    Boundary-tag pools
+*/
+static size_t _mem_tag_size(tag_pt block) {
+    return block->tag & ~(size_t) 1;
+}
+
+static size_t _mem_tag_allocated(tag_pt block) {
+    return block->tag & 1;
+}
+
+// Writes the header and the footer of a block.
+static void _mem_tag_set(tag_pt block, size_t size, size_t allocated) {
+    block->tag = size | allocated;
+    *(size_t*) ((char*) block + size - sizeof(size_t)) = size | allocated;
+    block->record.mem = (char*) block + sizeof(tag_t);
+    block->record.size = size - MEM_TAG_OVERHEAD;
+}
+
+// The end of the last whole block, pool.mem is only used up to a multiple of 8.
+static char *_mem_tag_end(pool_mgr_pt pool_mgr) {
+    return pool_mgr->pool.mem + (pool_mgr->pool.total_size & ~(size_t) 7);
+}
+
+static alloc_pt _mem_tag_new_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    size_t need = ((size + 7) & ~(size_t) 7) + MEM_TAG_OVERHEAD;
+    if (need < MEM_TAG_MIN_BLOCK){
+        need = MEM_TAG_MIN_BLOCK;
+    }
+    if (need < size){//overflow
+        return NULL;
+    }
+    char *end = _mem_tag_end(pool_mgr);
+    tag_pt found = NULL;
+    tag_pt block = (tag_pt) pool_mgr->pool.mem;
+    while ((char*) block < end){
+        size_t block_size = _mem_tag_size(block);
+        if (!_mem_tag_allocated(block) && block_size >= need){
+            if (pool_mgr->pool.policy == WORST_FIT){
+                if (found == NULL || block_size > _mem_tag_size(found)){
+                    found = block;
+                }
+            }else if (found == NULL || block_size < _mem_tag_size(found)){
+                found = block;
+                if (pool_mgr->pool.policy == FIRST_FIT || block_size == need
+                    || (pool_mgr->pool.policy == GOOD_FIT && _mem_good_fit(pool_mgr, block_size, need))){
+                    break;
+                }
+            }
+        }
+        block = (tag_pt) ((char*) block + block_size);
+    }
+    if (found == NULL){
+        return NULL;
+    }
+    size_t rem = _mem_tag_size(found) - need;
+    if (rem >= MEM_TAG_MIN_BLOCK){
+        _mem_tag_set((tag_pt) ((char*) found + need), rem, 0);
+    }else{//too small to be a block of its own, hand it out with the allocation.
+        need += rem;
+        pool_mgr->pool.num_gaps -= 1;
+    }
+    _mem_tag_set(found, need, 1);
+    found->record.size = size;
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += size;
+    return &found->record;
+}
+
+static alloc_status _mem_tag_free(pool_mgr_pt pool_mgr, tag_pt block) {
+    char *end = _mem_tag_end(pool_mgr);
+    //the block must be an allocation header handed out by this pool.
+    if ((char*) block < pool_mgr->pool.mem || (char*) block + MEM_TAG_MIN_BLOCK > end
+        || ((char*) block - pool_mgr->pool.mem) % 8 != 0
+        || !_mem_tag_allocated(block) || block->record.mem != (char*) block + sizeof(tag_t)){
+        return ALLOC_NOT_FREED;
+    }
+    pool_mgr->pool.num_allocs -= 1;
+    pool_mgr->pool.alloc_size -= block->record.size;
+    size_t size = _mem_tag_size(block);
+    size_t gaps = pool_mgr->pool.num_gaps + 1;
+    //merge the next block, found from our own size
+    tag_pt next = (tag_pt) ((char*) block + size);
+    if ((char*) next < end && !_mem_tag_allocated(next)){
+        size += _mem_tag_size(next);
+        gaps -= 1;
+    }
+    //merge the previous block, found from its footer right before us
+    if ((char*) block > pool_mgr->pool.mem){
+        size_t prev_tag = *(size_t*) ((char*) block - sizeof(size_t));
+        if ((prev_tag & 1) == 0){
+            block = (tag_pt) ((char*) block - prev_tag);
+            size += prev_tag;
+            gaps -= 1;
+        }
+    }
+    _mem_tag_set(block, size, 0);
+    pool_mgr->pool.num_gaps = (unsigned) gaps;
+    return ALLOC_OK;
+}
+
+static void _mem_tag_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments) {
+    unsigned count = pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps;
+    pool_segment_pt arr = (pool_segment_pt) malloc(sizeof(pool_segment_t) * (count + 1));
+    if (arr == NULL){
+        return;
+    }
+    char *end = _mem_tag_end(pool_mgr);
+    tag_pt block = (tag_pt) pool_mgr->pool.mem;
+    unsigned i = 0;
+    while ((char*) block < end && i < count){
+        arr[i].allocated = _mem_tag_allocated(block);
+        arr[i].size = block->record.size;
+        i += 1;
+        block = (tag_pt) ((char*) block + _mem_tag_size(block));
+    }
+    *segments = arr;
+    *num_segments = i;
+}
+
+/*
+    Bitmap pools
+*/
+static size_t _mem_bits_get(const uint64_t *map, size_t i) {
+    return (size_t) (map[i >> 6] >> (i & 63)) & 1;
+}
+
+// The first bit at or after from that equals value, or n if there is none.
+static size_t _mem_bits_find(const uint64_t *map, size_t from, size_t n, size_t value) {
+    if (from >= n){
+        return n;
+    }
+    uint64_t flip = value ? 0 : ~(uint64_t) 0;//look for ones in map ^ flip
+    size_t w = from >> 6;
+    size_t words = (n + 63) >> 6;
+    uint64_t word = (map[w] ^ flip) & (~(uint64_t) 0 << (from & 63));
+    while (word == 0){//64 granules at a time
+        w += 1;
+        if (w == words){
+            return n;
+        }
+        word = map[w] ^ flip;
+    }
+    size_t bit = (w << 6) + (size_t) __builtin_ctzll((unsigned long long) word);
+    return (bit < n) ? bit : n;
+}
+
+static void _mem_bits_set(uint64_t *map, size_t from, size_t count, size_t value) {
+    while (count != 0){
+        size_t bit = from & 63;
+        size_t take = (64 - bit < count) ? 64 - bit : count;
+        uint64_t mask = ((take == 64) ? ~(uint64_t) 0 : (((uint64_t) 1 << take) - 1)) << bit;
+        if (value){
+            map[from >> 6] |= mask;
+        }else{
+            map[from >> 6] &= ~mask;
+        }
+        from += take;
+        count -= take;
+    }
+}
+
+static alloc_pt _mem_bitmap_record(pool_mgr_pt pool_mgr, size_t r) {
+    return &pool_mgr->record_slabs[r / MEM_BITMAP_SLAB_RECORDS][r % MEM_BITMAP_SLAB_RECORDS];
+}
+
+// Takes an unused record, adding a slab when there is none. MEM_BITMAP_NO_RECORD on failure.
+static size_t _mem_bitmap_take_record(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->free_record == MEM_BITMAP_NO_RECORD){
+        size_t slabs = pool_mgr->num_records / MEM_BITMAP_SLAB_RECORDS;
+        alloc_pt *table = (alloc_pt*) realloc(pool_mgr->record_slabs, sizeof(alloc_pt) * (slabs + 1));
+        if (table == NULL){
+            return MEM_BITMAP_NO_RECORD;
+        }
+        pool_mgr->record_slabs = table;
+        table[slabs] = (alloc_pt) malloc(sizeof(alloc_t) * MEM_BITMAP_SLAB_RECORDS);
+        if (table[slabs] == NULL){
+            return MEM_BITMAP_NO_RECORD;
+        }
+        size_t i = MEM_BITMAP_SLAB_RECORDS;
+        while (i > 0){//chain them so the lowest comes out first
+            i -= 1;
+            table[slabs][i].mem = NULL;
+            table[slabs][i].size = pool_mgr->free_record;
+            pool_mgr->free_record = pool_mgr->num_records + i;
+        }
+        pool_mgr->num_records += MEM_BITMAP_SLAB_RECORDS;
+    }
+    size_t r = pool_mgr->free_record;
+    pool_mgr->free_record = _mem_bitmap_record(pool_mgr, r)->size;
+    return r;
+}
+
+static void _mem_bitmap_put_record(pool_mgr_pt pool_mgr, size_t r) {
+    alloc_pt record = _mem_bitmap_record(pool_mgr, r);
+    record->mem = NULL;
+    record->size = pool_mgr->free_record;
+    pool_mgr->free_record = r;
+}
+
+// Walks the free runs of granules in address order and takes the start of the one
+// the policy picks, FIRST_FIT stopping at the first that is long enough.
+static alloc_pt _mem_bitmap_new_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    size_t granules = (size >> pool_mgr->granule_shift) + ((size & (pool_mgr->granule - 1)) != 0);
+    if (granules == 0){
+        granules = 1;
+    }
+    size_t n = pool_mgr->num_granules;
+    size_t found = n;
+    size_t found_len = 0;
+    size_t run = _mem_bits_find(pool_mgr->bitmap, 0, n, 0);
+    while (run < n){
+        size_t end = _mem_bits_find(pool_mgr->bitmap, run, n, 1);
+        size_t len = end - run;
+        if (len >= granules){
+            if (pool_mgr->pool.policy == WORST_FIT){
+                if (found == n || len > found_len){
+                    found = run;
+                    found_len = len;
+                }
+            }else if (found == n || len < found_len){
+                found = run;
+                found_len = len;
+                if (pool_mgr->pool.policy == FIRST_FIT || len == granules
+                    || (pool_mgr->pool.policy == GOOD_FIT
+                        && _mem_good_fit(pool_mgr, len << pool_mgr->granule_shift, granules << pool_mgr->granule_shift))){
+                    break;
+                }
+            }
+        }
+        run = _mem_bits_find(pool_mgr->bitmap, end, n, 0);
+    }
+    if (found == n){
+        return NULL;
+    }
+    size_t r = _mem_bitmap_take_record(pool_mgr);
+    if (r == MEM_BITMAP_NO_RECORD){
+        return NULL;
+    }
+    char *mem = pool_mgr->pool.mem + (found << pool_mgr->granule_shift);
+    if (_mem_ptr_ix_put(pool_mgr, mem, r) != ALLOC_OK){
+        _mem_bitmap_put_record(pool_mgr, r);
+        return NULL;
+    }
+    _mem_bits_set(pool_mgr->bitmap, found, granules, 1);
+    _mem_bits_set(pool_mgr->starts, found, 1, 1);
+    if (found_len == granules){//the gap is used up.
+        pool_mgr->pool.num_gaps -= 1;
+    }
+    alloc_pt record = _mem_bitmap_record(pool_mgr, r);
+    record->mem = mem;
+    record->size = granules << pool_mgr->granule_shift;
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += record->size;
+    return record;
+}
+
+// Frees the allocation at mem. alloc, if given, must be the record handed out for it.
+static alloc_status _mem_bitmap_free(pool_mgr_pt pool_mgr, char *mem, alloc_pt alloc) {
+    size_t r;
+    if (_mem_ptr_ix_get(pool_mgr, mem, &r) != ALLOC_OK){
+        return ALLOC_NOT_FREED;
+    }
+    alloc_pt record = _mem_bitmap_record(pool_mgr, r);
+    if (alloc != NULL && alloc != record){
+        return ALLOC_NOT_FREED;
+    }
+    size_t first = (size_t) (mem - pool_mgr->pool.mem) >> pool_mgr->granule_shift;
+    size_t granules = record->size >> pool_mgr->granule_shift;
+    size_t gaps = pool_mgr->pool.num_gaps + 1;
+    //the gaps on either side merge with it, there is nothing to unlink.
+    if (first > 0 && !_mem_bits_get(pool_mgr->bitmap, first - 1)){
+        gaps -= 1;
+    }
+    if (first + granules < pool_mgr->num_granules && !_mem_bits_get(pool_mgr->bitmap, first + granules)){
+        gaps -= 1;
+    }
+    _mem_bits_set(pool_mgr->bitmap, first, granules, 0);
+    _mem_bits_set(pool_mgr->starts, first, 1, 0);
+    _mem_ptr_ix_remove(pool_mgr, mem);
+    pool_mgr->pool.num_gaps = (unsigned) gaps;
+    pool_mgr->pool.num_allocs -= 1;
+    pool_mgr->pool.alloc_size -= record->size;
+    _mem_bitmap_put_record(pool_mgr, r);
     return ALLOC_OK;
-    // loop from num_gaps - 1 until but not including 0:
-    //    if the size of the current entry is less than the previous (u - 1)
-    //       swap them (by copying) (remember to use a temporary variable)
+}
 
+static void _mem_bitmap_inspect(pool_mgr_pt pool_mgr, pool_segment_pt *segments, unsigned *num_segments) {
+    unsigned count = pool_mgr->pool.num_allocs + pool_mgr->pool.num_gaps;
+    pool_segment_pt arr = (pool_segment_pt) malloc(sizeof(pool_segment_t) * (count + 1));
+    if (arr == NULL){
+        return;
+    }
+    size_t n = pool_mgr->num_granules;
+    size_t g = 0;
+    unsigned i = 0;
+    while (g < n && i < count){
+        size_t end;
+        if (_mem_bits_get(pool_mgr->bitmap, g)){
+            //an allocation runs up to the next one or the next gap.
+            end = _mem_bits_find(pool_mgr->starts, g + 1, n, 1);
+            size_t gap = _mem_bits_find(pool_mgr->bitmap, g, n, 0);
+            end = (gap < end) ? gap : end;
+            arr[i].allocated = 1;
+        }else{
+            end = _mem_bits_find(pool_mgr->bitmap, g, n, 1);
+            arr[i].allocated = 0;
+        }
+        arr[i].size = (end - g) << pool_mgr->granule_shift;
+        i += 1;
+        g = end;
+    }
+    *segments = arr;
+    *num_segments = i;
+}
+
+static void _mem_bitmap_release(pool_mgr_pt pool_mgr) {
+    free(pool_mgr->bitmap);
+    free(pool_mgr->starts);
+    pool_mgr->bitmap = NULL;
+    pool_mgr->starts = NULL;
+    size_t i = 0;
+    while (i < pool_mgr->num_records / MEM_BITMAP_SLAB_RECORDS){
+        free(pool_mgr->record_slabs[i]);
+        i += 1;
+    }
+    free(pool_mgr->record_slabs);
+    pool_mgr->record_slabs = NULL;
+    pool_mgr->num_records = 0;
 }
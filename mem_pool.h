@@ -7,9 +7,15 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+/* WORST_FIT carves from the largest gap; GOOD_FIT takes the first gap within the
+   pool's slack (mem_pool_set_good_fit_slack) of the request, else the best fit */
+typedef enum _alloc_policy { FIRST_FIT, BEST_FIT, WORST_FIT, GOOD_FIT } alloc_policy;
 
 typedef struct _pool {
     char *mem;
@@ -30,11 +36,49 @@ typedef struct _pool_segment {
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+typedef struct _pool_stats {
+    unsigned long quick_hits; // requests served from the deferred-coalescing quick list
+    unsigned long quick_misses;
+    unsigned long sweeps; // times the quick list was coalesced
+    unsigned quick_count; // blocks held in the quick list right now
+} pool_stats_t, *pool_stats_pt;
+
+/* where mem_pool_open_ex puts the pool memory on a NUMA machine: anywhere, on numa_node, or spread over all nodes */
+typedef enum _numa_placement { NUMA_DEFAULT, NUMA_BIND, NUMA_INTERLEAVE } numa_placement;
+
+typedef struct _mem_pool_config {
+    unsigned node_heap_capacity; // nodes to start with (one per allocation or gap)
+    float node_heap_fill_factor; // grow once this full, in (0, 1]
+    unsigned node_heap_expand_factor; // by this factor, at least 2
+    unsigned gap_ix_capacity;
+    float gap_ix_fill_factor;
+    unsigned gap_ix_expand_factor;
+    unsigned prefault; // 1: fault the pool memory in at open (threaded for pools >= 1 GiB)
+    numa_placement numa; // ignored on a single node
+    unsigned numa_node; // for NUMA_BIND, which fails on a node that isn't online
+} mem_pool_config_t, *mem_pool_config_pt;
+
+typedef struct _pool_snapshot *pool_snapshot_pt;
+
+typedef struct _numa_group *numa_group_pt;
+
+/* a size range of a pool group: requests up to max_size are served by pools of pool_size,
+   bitmap pools of that granule if it isn't 0, heap pools with size classes if it is */
+typedef struct _mem_group_class {
+    size_t max_size;
+    size_t pool_size;
+    size_t granule;
+    alloc_policy policy;
+} mem_group_class_t, *mem_group_class_pt;
+
+typedef struct _mem_group *mem_group_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
     ALLOC_CALLED_AGAIN,
-    ALLOC_NOT_FREED
+    ALLOC_NOT_FREED,
+    ALLOC_INCOMPLETE
 } alloc_status;
 
 /* function declarations */
@@ -48,16 +92,115 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+/* mem_pool_open with initial capacities and growth factors; 0 fields (or NULL) take the defaults */
+pool_pt
+mem_pool_open_ex(size_t size, alloc_policy policy, const mem_pool_config_t *config);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+/* mem_new_alloc with a zeroed payload; memory that is still zero from the pool's creation isn't touched */
+alloc_pt
+mem_new_alloc_zeroed(pool_pt pool, size_t size);
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+/* frees the allocation whose payload starts at p (alloc->mem), without needing the alloc_pt */
+alloc_status
+mem_del_ptr(pool_pt pool, void *p);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+/* opens a pool that keeps its metadata in the pool memory as boundary tags */
+pool_pt
+mem_pool_open_tagged(size_t size, alloc_policy policy);
+
+/* opens a pool of granule-sized blocks (a power of 2) tracked by a bitmap, one bit per granule */
+pool_pt
+mem_pool_open_bitmap(size_t size, size_t granule, alloc_policy policy);
+
+/* rounds requests up to size classes (NULL: a default table) and keeps gaps under min_gap with the allocation */
+alloc_status
+mem_pool_set_size_classes(pool_pt pool, const size_t *classes, unsigned num_classes, size_t min_gap);
+
+/* holds up to threshold freed blocks for exact-size reuse, coalescing them on a miss (0 = off) */
+alloc_status
+mem_pool_set_deferred_coalescing(pool_pt pool, unsigned threshold);
+
+alloc_status
+mem_pool_get_stats(pool_pt pool, pool_stats_pt stats);
+
+/* percent of the request a gap may exceed it by for GOOD_FIT to take it (default 25) */
+alloc_status
+mem_pool_set_good_fit_slack(pool_pt pool, unsigned percent);
+
+/* moves up to budget bytes of allocations (0 = all), returns ALLOC_INCOMPLETE until done */
+alloc_status
+mem_pool_compact(pool_pt pool, size_t budget);
+
+/* opens (or creates) a pool that lives in a file; closing it keeps the allocations in the file.
+   It is mapped back where it was created if that range is free and moved otherwise, but not
+   while the file is open in this process already. A mapped pool has room for 4096 nodes
+   (allocations and gaps together); past that, allocations fail instead of growing it. */
+pool_pt
+mem_pool_open_file(const char *path, size_t size, alloc_policy policy);
+
+/* opens (or creates) a pool in POSIX shared memory, usable from every process that opens it.
+   The pool keeps absolute pointers, so every process maps it at its creator's address, and
+   the open fails (NULL) in a process where that range is already taken. 4096 nodes, as above. */
+pool_pt
+mem_pool_open_shared(const char *name, size_t size, alloc_policy policy);
+
+alloc_status
+mem_pool_unlink_shared(const char *name);
+
+/* the open pool whose memory holds p (any address in it, not just alloc->mem), NULL if none */
+pool_pt
+mem_pool_of(const void *p);
+
+/* opens a pool bound to each NUMA node, so threads can allocate from the one local to them */
+numa_group_pt
+mem_numa_group_open(size_t size, alloc_policy policy, const mem_pool_config_t *config);
+
+/* the group's pool on the calling thread's node */
+pool_pt
+mem_numa_group_local(numa_group_pt group);
+
+alloc_status
+mem_numa_group_close(numa_group_pt group);
+
+/* opens a group that routes each request by size to a pool of its class (NULL: a default
+   table); a request above the last class gets a pool of its own */
+mem_group_pt
+mem_group_open(const mem_group_class_t *classes, unsigned num_classes);
+
+alloc_pt
+mem_group_alloc(mem_group_pt group, size_t size);
+
+/* frees p (alloc->mem) from whichever pool of the group holds it */
+alloc_status
+mem_group_free(mem_group_pt group, void *p);
+
+alloc_status
+mem_group_close(mem_group_pt group);
+
+/* copies the pool metadata and the allocated bytes (not the gaps) so the pool can be rolled back */
+pool_snapshot_pt
+mem_pool_snapshot(pool_pt pool);
+
+alloc_status
+mem_pool_restore(pool_pt pool, pool_snapshot_pt snap);
+
+void
+mem_pool_snapshot_free(pool_snapshot_pt snap);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
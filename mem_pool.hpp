@@ -0,0 +1,443 @@
+/*
+ * C++ adapters for the memory pool manager. Header only, nothing to link
+ * beyond mem_pool.c.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_HPP
+#define DENVER_OS_PA_C_MEM_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "mem_pool.h"
+
+namespace mem {
+
+/*
+ * std::pmr::memory_resource over a pool, so pmr containers can allocate from it:
+ *
+ *     mem::mem_pool_resource res(pool);
+ *     std::pmr::vector<int> v(&res);
+ *
+ * The pool is not owned. Every block carries the start of its allocation just below
+ * the returned address, which is all mem_del_ptr needs to free it. That is an address
+ * in pool.mem, not an alloc_pt, so it stays valid however the node heap grows.
+ */
+class mem_pool_resource : public std::pmr::memory_resource {
+public:
+    explicit mem_pool_resource(pool_pt pool) noexcept : pool_(pool) {}
+
+    pool_pt pool() const noexcept { return pool_; }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (alignment < alignof(char *))
+            alignment = alignof(char *);
+        if (bytes > SIZE_MAX - sizeof(char *) - alignment)   // the padding would wrap around
+            throw std::bad_alloc();
+        alloc_pt alloc = mem_new_alloc(pool_, bytes + sizeof(char *) + alignment - 1);
+        if (alloc == nullptr)
+            throw std::bad_alloc();
+        std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(alloc->mem) + sizeof(char *);
+        addr = (addr + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+        void *p = reinterpret_cast<void *>(addr);
+        start(p) = alloc->mem;
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t, std::size_t) override {
+        mem_del_ptr(pool_, start(p));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        const mem_pool_resource *res = dynamic_cast<const mem_pool_resource *>(&other);
+        return res != nullptr && res->pool_ == pool_;
+    }
+
+private:
+    static char *&start(void *p) noexcept {
+        return *(reinterpret_cast<char **>(p) - 1);
+    }
+
+    pool_pt pool_;
+};
+
+namespace detail {
+
+// Room for a T at its alignment, wherever mem_new_alloc happens to put it.
+template <class T>
+constexpr std::size_t alloc_size() noexcept {
+    return sizeof(T) + (alignof(T) > 1 ? alignof(T) - 1 : 0);
+}
+
+template <class T>
+inline T *align(char *mem) noexcept {
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(mem);
+    addr = (addr + alignof(T) - 1) & ~static_cast<std::uintptr_t>(alignof(T) - 1);
+    return reinterpret_cast<T *>(addr);
+}
+
+} // namespace detail
+
+/*
+ * Move-only owner of one T constructed in a pool. Destroys the T and frees the
+ * allocation (by address, through mem_del_ptr) when it goes out of scope.
+ */
+template <class T>
+class Allocation {
+public:
+    Allocation() noexcept = default;
+    Allocation(pool_pt pool, char *mem, T *ptr) noexcept : pool_(pool), mem_(mem), ptr_(ptr) {}
+
+    Allocation(Allocation &&other) noexcept
+            : pool_(other.pool_), mem_(other.mem_), ptr_(other.ptr_) {
+        other.ptr_ = nullptr;
+    }
+
+    Allocation &operator=(Allocation &&other) noexcept {
+        if (this != &other) {
+            reset();
+            pool_ = other.pool_;
+            mem_ = other.mem_;
+            ptr_ = other.ptr_;
+            other.ptr_ = nullptr;
+        }
+        return *this;
+    }
+
+    Allocation(const Allocation &) = delete;
+    Allocation &operator=(const Allocation &) = delete;
+
+    ~Allocation() { reset(); }
+
+    T *get() const noexcept { return ptr_; }
+    T &operator*() const noexcept { return *ptr_; }
+    T *operator->() const noexcept { return ptr_; }
+    explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+    void reset() noexcept {
+        if (ptr_ != nullptr) {
+            ptr_->~T();
+            mem_del_ptr(pool_, mem_);
+            ptr_ = nullptr;
+        }
+    }
+
+private:
+    pool_pt pool_ = nullptr;
+    char *mem_ = nullptr;   // alloc->mem, what mem_del_ptr wants back
+    T *ptr_ = nullptr;
+};
+
+// Allocates room for a T in pool and constructs it there from args.
+template <class T, class... Args>
+Allocation<T> make(pool_pt pool, Args &&...args) {
+    alloc_pt alloc = mem_new_alloc(pool, detail::alloc_size<T>());
+    if (alloc == nullptr)
+        throw std::bad_alloc();
+    char *mem = alloc->mem;
+    T *ptr;
+    try {
+        ptr = ::new (static_cast<void *>(detail::align<T>(mem))) T(std::forward<Args>(args)...);
+    } catch (...) {
+        mem_del_ptr(pool, mem);
+        throw;
+    }
+    return Allocation<T>(pool, mem, ptr);
+}
+
+/*
+ * Move-only owner of a pool, closed when it goes out of scope. mem_init() has to
+ * have been called, and all allocations released before the pool is closed.
+ */
+class Pool {
+public:
+    Pool(std::size_t size, alloc_policy policy = FIRST_FIT) : pool_(mem_pool_open(size, policy)) {
+        if (pool_ == nullptr)
+            throw std::bad_alloc();
+    }
+
+    // Takes over a pool opened some other way (file, shared, tagged).
+    explicit Pool(pool_pt pool) noexcept : pool_(pool) {}
+
+    Pool(Pool &&other) noexcept : pool_(other.pool_) { other.pool_ = nullptr; }
+
+    Pool &operator=(Pool &&other) noexcept {
+        if (this != &other) {
+            close();
+            pool_ = other.pool_;
+            other.pool_ = nullptr;
+        }
+        return *this;
+    }
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    ~Pool() { close(); }
+
+    pool_pt get() const noexcept { return pool_; }
+    pool_t *operator->() const noexcept { return pool_; }
+
+    pool_pt release() noexcept {
+        pool_pt pool = pool_;
+        pool_ = nullptr;
+        return pool;
+    }
+
+    template <class T, class... Args>
+    Allocation<T> make(Args &&...args) {
+        return mem::make<T>(pool_, std::forward<Args>(args)...);
+    }
+
+private:
+    void close() noexcept {
+        if (pool_ != nullptr) {
+            mem_pool_close(pool_);
+            pool_ = nullptr;
+        }
+    }
+
+    pool_pt pool_;
+};
+
+namespace detail {
+
+/*
+ * Fixed-size slots for the one-at-a-time allocations node-based containers make.
+ * Slots are carved 64 at a time out of pool chunks and recycled through a free
+ * list, so most node allocations and frees never reach mem_new_alloc/mem_del_ptr.
+ * Shared by a pool_allocator and all its rebound copies; the chunks go back to the
+ * pool with the last of them.
+ */
+class slab_cache {
+public:
+    static constexpr std::size_t max_slot = 256;
+    static constexpr std::size_t chunk_slots = 64;
+
+    explicit slab_cache(pool_pt pool) noexcept : pool_(pool) {}
+
+    slab_cache(const slab_cache &) = delete;
+    slab_cache &operator=(const slab_cache &) = delete;
+
+    ~slab_cache() {
+        while (chunks_ != nullptr) {
+            chunk *next = chunks_->next;
+            mem_del_ptr(pool_, chunks_->mem);
+            chunks_ = next;
+        }
+    }
+
+    pool_pt pool() const noexcept { return pool_; }
+
+    void *allocate(std::size_t slot) {
+        slab &s = find(slot);
+        if (s.free == nullptr)
+            refill(s);
+        free_slot *p = s.free;
+        s.free = p->next;
+        return p;
+    }
+
+    void deallocate(void *p, std::size_t slot) noexcept {
+        slab &s = find(slot);
+        free_slot *f = static_cast<free_slot *>(p);
+        f->next = s.free;
+        s.free = f;
+    }
+
+private:
+    struct free_slot { free_slot *next; };
+    struct chunk { chunk *next; char *mem; };
+    struct slab { std::size_t slot; free_slot *free; };
+
+    static constexpr std::size_t max_slabs = 8;
+    static constexpr std::size_t align = alignof(std::max_align_t);
+
+    slab &find(std::size_t slot) {
+        for (std::size_t i = 0; i < num_slabs_; ++i)
+            if (slabs_[i].slot == slot)
+                return slabs_[i];
+        if (num_slabs_ == max_slabs)
+            throw std::bad_alloc();
+        slabs_[num_slabs_] = slab{slot, nullptr};
+        return slabs_[num_slabs_++];
+    }
+
+    void refill(slab &s) {
+        std::size_t header = (sizeof(chunk) + align - 1) & ~(align - 1);
+        alloc_pt alloc = mem_new_alloc(pool_, header + s.slot * chunk_slots + align - 1);
+        if (alloc == nullptr)
+            throw std::bad_alloc();
+        std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(alloc->mem);
+        addr = (addr + align - 1) & ~static_cast<std::uintptr_t>(align - 1);
+        chunk *c = reinterpret_cast<chunk *>(addr);
+        c->next = chunks_;
+        c->mem = alloc->mem;
+        chunks_ = c;
+        char *slots = reinterpret_cast<char *>(c) + header;
+        for (std::size_t i = chunk_slots; i-- > 0;) {
+            free_slot *f = reinterpret_cast<free_slot *>(slots + i * s.slot);
+            f->next = s.free;
+            s.free = f;
+        }
+    }
+
+    pool_pt pool_;
+    slab slabs_[max_slabs] = {};
+    std::size_t num_slabs_ = 0;
+    chunk *chunks_ = nullptr;
+};
+
+} // namespace detail
+
+/*
+ * Standard allocator over a pool, for std::vector<T, mem::pool_allocator<T>>,
+ * std::list, std::map and the like. No virtual calls. Single objects up to
+ * slab_cache::max_slot bytes (container nodes) come from the slab cache, anything
+ * else straight from the pool, with the start of its allocation kept just below it.
+ */
+template <class T>
+class pool_allocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit pool_allocator(pool_pt pool) : cache_(std::make_shared<detail::slab_cache>(pool)) {}
+
+    template <class U>
+    pool_allocator(const pool_allocator<U> &other) noexcept : cache_(other.cache_) {}
+
+    T *allocate(std::size_t n) {
+        if (n == 1 && slab_fit)
+            return static_cast<T *>(cache_->allocate(slot));
+        std::size_t align = alignof(T) < alignof(char *) ? alignof(char *) : alignof(T);
+        if (n > (SIZE_MAX - sizeof(char *) - align) / sizeof(T))
+            throw std::bad_alloc();
+        alloc_pt alloc = mem_new_alloc(cache_->pool(), n * sizeof(T) + sizeof(char *) + align - 1);
+        if (alloc == nullptr)
+            throw std::bad_alloc();
+        std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(alloc->mem) + sizeof(char *);
+        addr = (addr + align - 1) & ~static_cast<std::uintptr_t>(align - 1);
+        char **start = reinterpret_cast<char **>(addr) - 1;
+        *start = alloc->mem;
+        return reinterpret_cast<T *>(addr);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        if (n == 1 && slab_fit)
+            cache_->deallocate(p, slot);
+        else
+            mem_del_ptr(cache_->pool(), *(reinterpret_cast<char **>(p) - 1));
+    }
+
+    template <class U>
+    bool operator==(const pool_allocator<U> &other) const noexcept { return cache_ == other.cache_; }
+
+    template <class U>
+    bool operator!=(const pool_allocator<U> &other) const noexcept { return cache_ != other.cache_; }
+
+private:
+    template <class U>
+    friend class pool_allocator;
+
+    // slot size: a free list link has to fit, and slots stay aligned for T
+    static constexpr std::size_t slot_raw = sizeof(T) < sizeof(void *) ? sizeof(void *) : sizeof(T);
+    static constexpr std::size_t slot_align = alignof(T) < alignof(void *) ? alignof(void *) : alignof(T);
+    static constexpr std::size_t slot = (slot_raw + slot_align - 1) & ~(slot_align - 1);
+    static constexpr bool slab_fit = slot <= detail::slab_cache::max_slot
+                                     && alignof(T) <= alignof(std::max_align_t);
+
+    std::shared_ptr<detail::slab_cache> cache_;
+};
+
+/*
+ * N slots for T, carved once out of a single pool allocation. The slot size and
+ * alignment are worked out from T at compile time, and acquire/release are a pop
+ * and a push on an intrusive free list. With no pool given, the object pool opens
+ * one of exactly the right size and closes it again when destroyed.
+ * Every object has to be released before the object pool goes away.
+ */
+template <class T, std::size_t N>
+class ObjectPool {
+public:
+    static_assert(N > 0, "ObjectPool needs at least one slot");
+
+    static constexpr std::size_t slot_align = alignof(T) < alignof(void *) ? alignof(void *) : alignof(T);
+    static constexpr std::size_t slot_size =
+            ((sizeof(T) < sizeof(void *) ? sizeof(void *) : sizeof(T)) + slot_align - 1) & ~(slot_align - 1);
+    static constexpr std::size_t region_size = slot_size * N + slot_align - 1;
+
+    ObjectPool() : owned_(region_size) { carve(owned_.get()); }
+
+    explicit ObjectPool(pool_pt pool) : owned_(nullptr) { carve(pool); }
+
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+    ~ObjectPool() { mem_del_ptr(pool_, mem_); }
+
+    template <class... Args>
+    T *acquire(Args &&...args) {
+        if (free_ == nullptr)
+            throw std::bad_alloc();
+        free_slot *slot = free_;
+        free_slot *next = slot->next;
+        try {
+            T *obj = ::new (static_cast<void *>(slot)) T(std::forward<Args>(args)...);
+            free_ = next;
+            --available_;
+            return obj;
+        } catch (...) {
+            slot->next = next;          // T may have written over the link before throwing
+            throw;
+        }
+    }
+
+    void release(T *obj) noexcept {
+        obj->~T();
+        free_slot *slot = reinterpret_cast<free_slot *>(obj);
+        slot->next = free_;
+        free_ = slot;
+        ++available_;
+    }
+
+    std::size_t available() const noexcept { return available_; }
+
+private:
+    struct free_slot { free_slot *next; };
+
+    void carve(pool_pt pool) {
+        alloc_pt alloc = mem_new_alloc(pool, region_size);
+        if (alloc == nullptr)
+            throw std::bad_alloc();
+        pool_ = pool;
+        mem_ = alloc->mem;
+        std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(mem_);
+        addr = (addr + slot_align - 1) & ~static_cast<std::uintptr_t>(slot_align - 1);
+        char *slots = reinterpret_cast<char *>(addr);
+        for (std::size_t i = N; i-- > 0;) {
+            free_slot *slot = reinterpret_cast<free_slot *>(slots + i * slot_size);
+            slot->next = free_;
+            free_ = slot;
+        }
+        available_ = N;
+    }
+
+    Pool owned_;            // declared first, so it is closed after the region is freed
+    pool_pt pool_ = nullptr;
+    char *mem_ = nullptr;
+    free_slot *free_ = nullptr;
+    std::size_t available_ = 0;
+};
+
+} // namespace mem
+
+#endif //DENVER_OS_PA_C_MEM_POOL_HPP
@@ -0,0 +1,304 @@
+//
+// Tests for the C++ adapters in mem_pool.hpp.
+//
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <csetjmp>
+
+#include <functional>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <cmocka.h>
+}
+
+#include "mem_pool.hpp"
+
+
+/*****         helper types            *****/
+
+namespace {
+
+struct point {
+    point(int x, int y) : x(x), y(y) { ++live; }
+    ~point() { --live; }
+
+    int x;
+    int y;
+    static int live;
+};
+
+int point::live = 0;
+
+struct alignas(64) wide {
+    char bytes[100];
+};
+
+struct big {
+    char bytes[2000];
+};
+
+struct throws {
+    throws() { throw 1; }
+};
+
+// writes all over its storage before giving up, when asked to fail
+struct scribbles {
+    explicit scribbles(bool fail) {
+        std::memset(static_cast<void *>(this), 0xab, sizeof(*this));
+        if (fail)
+            throw 1;
+    }
+
+    char bytes[32];
+};
+
+template <class T>
+using pool_vector = std::vector<T, mem::pool_allocator<T>>;
+
+using pool_map = std::map<int, int, std::less<int>, mem::pool_allocator<std::pair<const int, int>>>;
+
+} // namespace
+
+
+/*****          test cases             *****/
+
+static void test_hpp_pool(void **state) {
+    assert_int_equal(mem_init(), ALLOC_OK);
+    {
+        mem::Pool pool(1000);
+        mem::Allocation<point> p = pool.make<point>(1, 2);
+        assert_true(static_cast<bool>(p));
+        assert_int_equal(p->x, 1);
+        assert_int_equal((*p).y, 2);
+        assert_int_equal(point::live, 1);
+        assert_int_equal(pool->num_allocs, 1);
+
+        // moving hands over the allocation, it is only freed once
+        mem::Allocation<point> q = std::move(p);
+        assert_false(static_cast<bool>(p));
+        assert_int_equal(q->x, 1);
+        q.reset();
+        assert_false(static_cast<bool>(q));
+        assert_int_equal(point::live, 0);
+        assert_int_equal(pool->num_allocs, 0);
+
+        // over-aligned types land on their alignment
+        mem::Allocation<wide> w = mem::make<wide>(pool.get());
+        assert_int_equal(reinterpret_cast<std::uintptr_t>(w.get()) % alignof(wide), 0);
+        w.reset();
+
+        // a throwing constructor leaves nothing behind
+        bool thrown = false;
+        try {
+            pool.make<throws>();
+        } catch (int) {
+            thrown = true;
+        }
+        assert_true(thrown);
+        assert_int_equal(pool->num_allocs, 0);
+
+        // so does a pool that is out of room
+        thrown = false;
+        try {
+            pool.make<big>();
+        } catch (const std::bad_alloc &) {
+            thrown = true;
+        }
+        assert_true(thrown);
+        assert_int_equal(pool->num_allocs, 0);
+
+        mem::Pool moved = std::move(pool);
+        assert_null(pool.get());
+        assert_non_null(moved.get());
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_hpp_pool_allocator(void **state) {
+    assert_int_equal(mem_init(), ALLOC_OK);
+    {
+        mem::Pool pool(1 << 20);
+        {
+            // node containers take their nodes from the slab cache
+            pool_map map{mem::pool_allocator<std::pair<const int, int>>(pool.get())};
+            for (int i = 0; i < 1000; ++i)
+                map[i] = i * i;
+            std::list<int, mem::pool_allocator<int>> list{mem::pool_allocator<int>(pool.get())};
+            for (int i = 0; i < 1000; ++i)
+                list.push_back(i);
+            assert_int_equal(map.size(), 1000);
+            assert_int_equal(map[999], 999 * 999);
+            for (int i = 0; i < 1000; i += 2)
+                map.erase(i);
+            assert_int_equal(map.size(), 500);
+            assert_int_equal(map.begin()->first, 1);
+            assert_int_equal(list.back(), 999);
+            // rebound copies share a slab cache, separate allocators don't
+            assert_true(mem::pool_allocator<int>(map.get_allocator()) == map.get_allocator());
+            assert_true(map.get_allocator() != list.get_allocator());
+
+            // arrays go straight to the pool
+            pool_vector<double> v{mem::pool_allocator<double>(pool.get())};
+            for (int i = 0; i < 10000; ++i)
+                v.push_back(i);
+            assert_int_equal(v[9999], 9999);
+            assert_int_equal(reinterpret_cast<std::uintptr_t>(v.data()) % alignof(double), 0);
+            assert_true(pool->num_allocs > 0);
+
+            // as is an array whose header and padding would wrap around
+            bool thrown = false;
+            try {
+                v.get_allocator().allocate(SIZE_MAX / sizeof(double));
+            } catch (const std::bad_alloc &) {
+                thrown = true;
+            }
+            assert_true(thrown);
+        }
+        // the last container took the slab chunks with it
+        assert_int_equal(pool->num_allocs, 0);
+        assert_int_equal(pool->alloc_size, 0);
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_hpp_object_pool(void **state) {
+    assert_int_equal(mem_init(), ALLOC_OK);
+    {
+        // opens a pool of its own
+        mem::ObjectPool<point, 4> objects;
+        assert_int_equal(objects.available(), 4);
+        point *p[4];
+        for (int i = 0; i < 4; ++i) {
+            p[i] = objects.acquire(i, -i);
+            assert_int_equal(reinterpret_cast<std::uintptr_t>(p[i]) % alignof(point), 0);
+        }
+        assert_int_equal(objects.available(), 0);
+        assert_int_equal(point::live, 4);
+        assert_int_equal(p[3]->y, -3);
+        bool thrown = false;
+        try {
+            objects.acquire(4, -4);
+        } catch (const std::bad_alloc &) {
+            thrown = true;
+        }
+        assert_true(thrown);
+
+        // a released slot is the next one handed out
+        objects.release(p[2]);
+        assert_int_equal(point::live, 3);
+        assert_int_equal(objects.available(), 1);
+        point *again = objects.acquire(7, 7);
+        assert_ptr_equal(again, p[2]);
+        assert_int_equal(again->x, 7);
+        p[2] = again;
+        for (int i = 0; i < 4; ++i)
+            objects.release(p[i]);
+        assert_int_equal(objects.available(), 4);
+        assert_int_equal(point::live, 0);
+    }
+    {
+        // or carves its region out of one it is given
+        mem::Pool pool(4096);
+        {
+            mem::ObjectPool<wide, 8> objects(pool.get());
+            assert_int_equal(pool->num_allocs, 1);
+            wide *w = objects.acquire();
+            assert_int_equal(reinterpret_cast<std::uintptr_t>(w) % alignof(wide), 0);
+            objects.release(w);
+        }
+        assert_int_equal(pool->num_allocs, 0);
+    }
+    {
+        // a constructor that throws gives its slot back intact
+        mem::ObjectPool<scribbles, 2> objects;
+        for (int i = 0; i < 3; ++i) {
+            bool thrown = false;
+            try {
+                objects.acquire(true);
+            } catch (int) {
+                thrown = true;
+            }
+            assert_true(thrown);
+            assert_int_equal(objects.available(), 2);
+        }
+        scribbles *a = objects.acquire(false);
+        scribbles *b = objects.acquire(false);
+        assert_ptr_not_equal(a, b);
+        assert_int_equal(objects.available(), 0);
+        objects.release(a);
+        objects.release(b);
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_hpp_pmr(void **state) {
+    assert_int_equal(mem_init(), ALLOC_OK);
+    {
+        mem::Pool pool(4 << 20);
+        mem::mem_pool_resource res(pool.get());
+        {
+            std::pmr::vector<int> v(&res);
+            for (int i = 0; i < 10000; ++i)
+                v.push_back(i);
+            assert_int_equal(v[9999], 9999);
+
+            // enough blocks that the node heap grows under the live ones
+            std::pmr::unordered_map<int, std::pmr::string> map(&res);
+            for (int i = 0; i < 2000; ++i)
+                map.emplace(i, std::pmr::string(100, static_cast<char>('a' + i % 26)));
+            assert_int_equal(map.size(), 2000);
+            assert_int_equal(map[1999][99], 'a' + 1999 % 26);
+            for (int i = 0; i < 2000; i += 2)
+                map.erase(i);
+            assert_int_equal(map.size(), 1000);
+
+            void *p = res.allocate(100, 256);
+            assert_int_equal(reinterpret_cast<std::uintptr_t>(p) % 256, 0);
+            res.deallocate(p, 100, 256);
+
+            // a size the header and padding would wrap around is refused
+            volatile std::size_t huge = SIZE_MAX - 8;   // not a constant the compiler can refuse
+            bool thrown = false;
+            try {
+                void *q = res.allocate(huge, 64);
+                res.deallocate(q, huge, 64);
+            } catch (const std::bad_alloc &) {
+                thrown = true;
+            }
+            assert_true(thrown);
+        }
+        assert_int_equal(pool->num_allocs, 0);
+
+        mem::mem_pool_resource same(pool.get());
+        mem::Pool other_pool(1000);
+        mem::mem_pool_resource other(other_pool.get());
+        assert_true(res.is_equal(same));
+        assert_false(res.is_equal(other));
+        assert_false(res.is_equal(*std::pmr::new_delete_resource()));
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*****          test runner            *****/
+
+int main() {
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test(test_hpp_pool),
+            cmocka_unit_test(test_hpp_pool_allocator),
+            cmocka_unit_test(test_hpp_object_pool),
+            cmocka_unit_test(test_hpp_pmr),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
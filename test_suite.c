@@ -2,8 +2,15 @@
 // Created by Ivo Georgiev on 3/3/16.
 //
 
+#define _GNU_SOURCE // for fork() and waitpid() under -std=c11
+
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -120,6 +127,36 @@ static void check_metadata(pool_pt pool,
 #endif
 }
 
+// Allocates size from a BEST_FIT pool and checks it landed where a plain scan of the
+// segments says: in the smallest gap that fits, the lowest addressed of equal ones.
+// Freeing it again leaves the pool as it was.
+static void check_best_fit(pool_pt pool, size_t size) {
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+
+    mem_inspect_pool(pool, &segs, &num_segs);
+    assert_non_null(segs);
+
+    size_t offset = 0, best_offset = 0, best_size = 0;
+    for (unsigned u = 0; u < num_segs; u ++) {
+        if (!segs[u].allocated && segs[u].size >= size && (best_size == 0 || segs[u].size < best_size)) {
+            best_size = segs[u].size;
+            best_offset = offset;
+        }
+        offset += segs[u].size;
+    }
+    free(segs);
+
+    alloc_pt alloc = mem_new_alloc(pool, size);
+    if (best_size == 0) {
+        assert_null(alloc);
+        return;
+    }
+    assert_non_null(alloc);
+    assert_ptr_equal(alloc->mem, pool->mem + best_offset);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+}
+
 
 
 /*******************************************/
@@ -154,6 +191,36 @@ static void test_pool_store_smoketest(void **state) {
     }
 }
 
+static void test_pool_store_reinit(void **state) {
+    const unsigned NUM_POOLS = 50;// past the store's initial 20, so it grows
+    pool_pt pools[50];
+
+    for (int i=0; i<NUM_TEST_ITERATIONS; i++) {
+        assert_int_equal(mem_init(), ALLOC_OK);
+        unsigned p = 0;
+        while (p < NUM_POOLS){
+            pools[p] = mem_pool_open(1000, (p % 2) ? BEST_FIT : FIRST_FIT);
+            assert_non_null(pools[p]);
+            assert_non_null(mem_new_alloc(pools[p], 100));
+            p += 1;
+        }
+        // a slot freed in the middle is reused
+        assert_int_equal(mem_del_ptr(pools[7], pools[7]->mem), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pools[7]), ALLOC_OK);
+        pools[7] = mem_pool_open(1000, FIRST_FIT);
+        assert_non_null(pools[7]);
+        assert_non_null(mem_new_alloc(pools[7], 100));
+        p = 0;
+        while (p < NUM_POOLS){
+            assert_ptr_equal(mem_pool_of(pools[p]->mem), pools[p]);
+            assert_int_equal(mem_del_ptr(pools[p], pools[p]->mem), ALLOC_OK);
+            assert_int_equal(mem_pool_close(pools[p]), ALLOC_OK);
+            p += 1;
+        }
+        assert_int_equal(mem_free(), ALLOC_OK);
+    }
+}
+
 static void test_pool_smoketest(void **state) {
     (void) state; /* unused */
 
@@ -2314,132 +2381,1421 @@ static void test_pool_scenario19(void **state) {
 }
 
 /*******************************************/
-/***          5. STRESS TEST             ***/
-/***                                     ***/
-/***         [non-functional]            ***/
-/***         [see NOTE below]            ***/
+/***         5. POOL EXTENSIONS          ***/
 /*******************************************/
 
-void test_pool_stresstest(void **state) {
+static void test_pool_compact(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Compaction:
+     *
+     * 1. Allocate 5 x 100, tag each with its index.
+     * 2. Deallocate 1 and 3.
+     * 3. Compact in 1-byte budget steps, then the allocations are packed
+     *    at the top of the pool and the rest is a single gap.
+     * 4. Clean up.
+     */
+
+    const unsigned NUM_ALLOCS = 5;
+    alloc_pt allocs[NUM_ALLOCS];
+
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+        memset(allocs[i]->mem, 'a' + i, allocs[i]->size);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
+
+    unsigned steps = 0;
+    while ((status = mem_pool_compact(pool, 1)) == ALLOC_INCOMPLETE)
+        ++steps;
+    assert_int_equal(status, ALLOC_OK);
+    assert_int_equal(steps, 1);
+
+    pool_segment_t exp0[4] =
+            {
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {pool->total_size - 300, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 300, 3, 1);
+
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i]) {
+            assert_true(allocs[i]->mem >= pool->mem && allocs[i]->mem < pool->mem + 300);
+            assert_int_equal(allocs[i]->mem[0], 'a' + i);
+            assert_int_equal(allocs[i]->mem[99], 'a' + i);
+        }
+    }
+
+    // clean up
+    for (int i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+
+    pool_segment_t exp1[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp1);
+}
+
+static void test_pool_file(void **state) {
     (void) state; /* unused */
 
-    const unsigned num_pools = 200;
-    const unsigned num_allocations = 1000;
-    const unsigned min_alloc_size = 10;
-    const unsigned pool_size =
-            (num_allocations / 2) *
-            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
-    assert_int_equal(pool_size, 5005000);
+    /*
+     * File-backed pool:
+     *
+     * 1. Open a new file pool, allocate 100 + 200 and fill them.
+     * 2. Close it with the allocations still live.
+     * 3. Reopen it, the segments and the data are still there.
+     * 4. Reopening with a different size is refused.
+     */
 
+    const char *path = "pool_file_test.bin";
+    remove(path);
 
-    pool_pt pools[num_pools];
-    alloc_pt allocations[num_pools][num_allocations];
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    memset(alloc0->mem, 'x', alloc0->size);
+    memset(alloc1->mem, 'y', alloc1->size);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_null(mem_pool_open_file(path, POOL_SIZE / 2, FIRST_FIT));
+
+    pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    pool_segment_t exp0[3] =
+            {
+                    {100, 1},
+                    {200, 1},
+                    {POOL_SIZE - 300, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 300, 2, 1);
+    assert_int_equal(pool->mem[0], 'x');
+    assert_int_equal(pool->mem[100], 'y');
+    assert_int_equal(pool->mem[299], 'y');
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+    remove(path);
+}
+
+static void test_pool_file_reopen(void **state) {
+    (void) state; /* unused */
 
     /*
-     * NOTE: This will work iff the address of the allocation
-     * in the pool is returned to the user instead of the
-     * address of the allocation record. Since allocation records
-     * are a part of the nodes, when the node heap is reallocated
-     * the node addresses shift with it, and so do the allocation
-     * record addresses. The allocation addresses on the pool
-     * remain the same, however, so they can be returned to the
-     * user and gotten from the user upon request for deletion.
+     * Reopening a file pool:
+     *
+     * 1. Grow the pool store past its initial capacity, then start over.
+     * 2. Open a file pool and allocate 100; opening the same file again while it
+     *    is mapped is refused, and the open pool is left as it was.
+     * 3. After a mem_free/mem_init cycle the file opens again, with its data.
      */
 
+    const char *path = "pool_file_reopen_test.bin";
+    remove(path);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pools[30];
+    unsigned i = 0;
+    while (i < 30){
+        pools[i] = mem_pool_open(1000, FIRST_FIT);
+        assert_non_null(pools[i]);
+        i += 1;
+    }
+    i = 0;
+    while (i < 30){
+        assert_int_equal(mem_pool_close(pools[i]), ALLOC_OK);
+        i += 1;
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 'r', alloc0->size);
+    assert_null(mem_pool_open_file(path, POOL_SIZE, FIRST_FIT));
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+    assert_ptr_equal(mem_pool_of(alloc0->mem), pool);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool = mem_pool_open_file(path, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+    assert_int_equal(pool->mem[99], 'r');
+    assert_null(mem_pool_open_file(path, POOL_SIZE, FIRST_FIT));
+    assert_int_equal(mem_del_ptr(pool, pool->mem), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+    remove(path);
+}
+
+static void test_pool_shared(void **state) {
+    (void) state; /* unused */
+
     /*
-     * Testing dynamic reallocation of pool structures:
+     * Shared-memory pool:
      *
-     * 1. 200 pools of 5005000 each (many pools)
-     * 2. In each pool 1000 allocations of different sizes (many allocations)
-     * 3. In each pool 500 deallocations (many gaps)
+     * 1. Open a new shared pool, allocate 100 and fill it, detach.
+     * 2. A child process attaches, frees the 100 and allocates 200 in its place.
+     * 3. The parent attaches again and sees the child's allocation.
+     * 4. Clean up.
      */
 
-    // initialize store
+    const char *name = "/denver_os_pa_c_shared_test";
+    mem_pool_unlink_shared(name);
+
     assert_int_equal(mem_init(), ALLOC_OK);
 
-    // allocate pools
-    for (unsigned pix=0; pix < num_pools; ++pix) {
-        // open pool
-        pools[pix] =
-                mem_pool_open(pool_size, (pix % 2) ? FIRST_FIT : BEST_FIT);
-        assert_non_null(pools[pix]);
-        // allocate pool
-        unsigned allocated = 0;
-        for (unsigned aix=0; aix < num_allocations; ++aix) {
-            allocations[pix][aix] =
-                    mem_new_alloc(pools[pix], (aix + 1) * min_alloc_size);
-            allocated += (aix + 1) * min_alloc_size;
-            if (!allocations[pix][aix]) {
-                INFO("ASSERT WILL FAIL at pix = %u, aix = %u, allocated = %u\n", pix, aix, allocated);
-            }
-            assert_non_null(allocations[pix][aix]);
-        }
-        // delete every other allocation
-        for (unsigned aix=0; aix < num_allocations; ++aix) {
-            if (aix % 2) {
-                assert_int_equal(
-                        mem_del_alloc(pools[pix], allocations[pix][aix]),
-                        ALLOC_OK);
-                allocations[pix][aix] = NULL;
-            }
-        }
+    pool_pt pool = mem_pool_open_shared(name, POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    memset(alloc0->mem, 'p', alloc0->size);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        pool_pt child = mem_pool_open_shared(name, POOL_SIZE, BEST_FIT);
+        int ok = child != NULL
+                 && child == pool
+                 && alloc0->mem[0] == 'p'
+                 && mem_del_alloc(child, alloc0) == ALLOC_OK;
+        alloc_pt alloc1 = ok ? mem_new_alloc(child, 200) : NULL;
+        if (alloc1) memset(alloc1->mem, 'c', alloc1->size);
+        ok = ok && alloc1 != NULL && mem_pool_close(child) == ALLOC_OK;
+        _exit(ok ? 0 : 1);
     }
+    int child_status = 0;
+    assert_int_equal(waitpid(pid, &child_status, 0), pid);
+    assert_true(WIFEXITED(child_status));
+    assert_int_equal(WEXITSTATUS(child_status), 0);
 
-    // delete pools
-    for (unsigned pix=0; pix < num_pools; ++pix) {
-        // delete pool's allocations
-        for (unsigned aix=0; aix < num_allocations; ++aix) {
-            if (allocations[pix][aix]) {
-                // delete allocation
-                assert_int_equal(
-                    mem_del_alloc(pools[pix], allocations[pix][aix]),
-                    ALLOC_OK);
-            }
+    pool = mem_pool_open_shared(name, POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    pool_segment_t exp0[2] =
+            {
+                    {200, 1},
+                    {POOL_SIZE - 200, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 200, 1, 1);
+    assert_int_equal(pool->mem[199], 'c');
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_shared_address_taken(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Shared pool whose address is taken:
+     *
+     * 1. Create a shared pool and detach, which leaves its range free.
+     * 2. Map something else over the start of that range: attaching fails.
+     * 3. Once the range is free again, attaching works.
+     */
+
+    const char *name = "/denver_os_pa_c_shared_taken_test";
+    mem_pool_unlink_shared(name);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_shared(name, POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_non_null(mem_new_alloc(pool, 100));
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    void *at = (void*) ((uintptr_t) pool & ~(uintptr_t) (page - 1));
+    void *squatter = mmap(at, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert_ptr_equal(squatter, at);
+    assert_null(mem_pool_open_shared(name, POOL_SIZE, FIRST_FIT));
+    assert_int_equal(munmap(squatter, page), 0);
+
+    pool_pt again = mem_pool_open_shared(name, POOL_SIZE, FIRST_FIT);
+    assert_ptr_equal(again, pool);
+    check_metadata(again, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+    assert_int_equal(mem_del_ptr(again, again->mem), ALLOC_OK);
+    assert_int_equal(mem_pool_close(again), ALLOC_OK);
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_shared_open_race(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Shared pool opened by two processes at once:
+     *
+     * 1. Parent and child are released together and both open the same new
+     *    name. One creates the pool, the other waits for it and attaches.
+     * 2. Each allocates 100 and detaches, the child reports by exit status.
+     * 3. The parent attaches again and finds both allocations, so neither
+     *    process initialized the pool over the other.
+     * Repeated, so the two opens land at different points of each other.
+     */
+
+    const char *name = "/denver_os_pa_c_shared_race_test";
+    const unsigned ROUNDS = 50;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    unsigned round = 0;
+    while (round < ROUNDS) {
+        mem_pool_unlink_shared(name);
+        int go[2];
+        assert_int_equal(pipe(go), 0);
+
+        pid_t pid = fork();
+        assert_true(pid >= 0);
+        if (pid == 0) {
+            char c;
+            close(go[1]);
+            int ok = read(go[0], &c, 1) == 1;
+            pool_pt child = ok ? mem_pool_open_shared(name, POOL_SIZE, BEST_FIT) : NULL;
+            alloc_pt alloc = child ? mem_new_alloc(child, 100) : NULL;
+            if (alloc) memset(alloc->mem, 'c', alloc->size);
+            ok = alloc != NULL && mem_pool_close(child) == ALLOC_OK;
+            _exit(ok ? 0 : 1);
         }
-        // close pool
-        assert_int_equal(mem_pool_close(pools[pix]), ALLOC_OK);
+        close(go[0]);
+        assert_int_equal(write(go[1], "g", 1), 1);
+        close(go[1]);
+        pool_pt pool = mem_pool_open_shared(name, POOL_SIZE, BEST_FIT);
+        assert_non_null(pool);
+        alloc_pt alloc = mem_new_alloc(pool, 100);
+        assert_non_null(alloc);
+        memset(alloc->mem, 'p', alloc->size);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+        int child_status = 0;
+        assert_int_equal(waitpid(pid, &child_status, 0), pid);
+        assert_true(WIFEXITED(child_status));
+        assert_int_equal(WEXITSTATUS(child_status), 0);
+
+        pool = mem_pool_open_shared(name, POOL_SIZE, BEST_FIT);
+        assert_non_null(pool);
+        check_metadata(pool, BEST_FIT, POOL_SIZE, 200, 2, 1);
+        assert_int_equal(pool->mem[0] + pool->mem[100], 'c' + 'p');
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+        round += 1;
     }
 
-    // free store
+    assert_int_equal(mem_pool_unlink_shared(name), ALLOC_OK);
     assert_int_equal(mem_free(), ALLOC_OK);
 }
 
+static void test_pool_snapshot(void **state) {
+    pool_pt pool = *state;
 
-/*******************************************/
-/***         6. DRIVER ROUTINE           ***/
-/*******************************************/
+    /*
+     * Snapshot and restore:
+     *
+     * 1. Allocate 100 + 200, fill them, take a snapshot.
+     * 2. Free the 100, overwrite the 200, allocate 50.
+     * 3. Restore, the pool and the data are back as they were in 1.
+     * 4. Clean up with the original allocation records.
+     */
 
-int run_test_suite() {
-    const struct CMUnitTest tests[] = {
-            cmocka_unit_test(test_pool_store_smoketest),
-            cmocka_unit_test(test_pool_smoketest),
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    memset(alloc0->mem, 'a', alloc0->size);
+    memset(alloc1->mem, 'b', alloc1->size);
 
-            cmocka_unit_test(test_pool_nonempty),
+    pool_snapshot_pt snap = mem_pool_snapshot(pool);
+    assert_non_null(snap);
 
-            cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    memset(alloc1->mem, 'z', alloc1->size);
+    assert_non_null(mem_new_alloc(pool, 50));
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 250, 2, 2);
 
-            cmocka_unit_test_setup_teardown(test_pool_scenario00, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario01, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario02, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario03, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario04, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario05, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario06, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario07, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario08, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario09, pool_ff_setup, pool_ff_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario10, pool_ff_setup, pool_ff_teardown),
+    assert_int_equal(mem_pool_restore(pool, snap), ALLOC_OK);
+    mem_pool_snapshot_free(snap);
 
-            cmocka_unit_test_setup_teardown(test_pool_scenario11, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario12, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario13, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario14, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario15, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario16, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario17, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
-            cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
+    pool_segment_t exp0[3] =
+            {
+                    {100, 1},
+                    {200, 1},
+                    {pool->total_size - 300, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 300, 2, 1);
+    assert_int_equal(alloc0->mem[99], 'a');
+    assert_int_equal(alloc1->mem[0], 'b');
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    pool_segment_t exp1[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp1);
+}
+
+static void test_pool_del_ptr(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Free by payload address:
+     *
+     * 1. Allocate 100, 200, 300.
+     * 2. Free the 200 by its payload address. An address inside
+     *    an allocation, or one already freed, is refused.
+     * 3. Free the rest by address, the pool is a single gap again.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    char *mem0 = alloc0->mem, *mem1 = alloc1->mem, *mem2 = alloc2->mem;
+
+    assert_int_equal(mem_del_ptr(pool, mem1 + 1), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_ptr(pool, mem1), ALLOC_OK);
+    assert_int_equal(mem_del_ptr(pool, mem1), ALLOC_NOT_FREED);
+
+    pool_segment_t exp0[4] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {300, 1},
+                    {pool->total_size - 600, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 400, 2, 2);
+
+    assert_int_equal(mem_del_ptr(pool, mem2), ALLOC_OK);
+    assert_int_equal(mem_del_ptr(pool, mem0), ALLOC_OK);
+
+    pool_segment_t exp1[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp1);
+}
+
+static void test_pool_zeroed(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Zeroed allocations:
+     *
+     * 1. A zeroed allocation from the fresh pool is all zeros.
+     * 2. Fill it, free it, and ask again: the same bytes come
+     *    back zeroed, along with fresh ones past the old end.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc_zeroed(pool, 1000);
+    assert_non_null(alloc0);
+    size_t i = 0;
+    while (i < 1000){
+        assert_int_equal(alloc0->mem[i], 0);
+        i += 1;
+    }
+    memset(alloc0->mem, 'x', 1000);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    alloc_pt alloc1 = mem_new_alloc_zeroed(pool, 2000);
+    assert_non_null(alloc1);
+    i = 0;
+    while (i < 2000){
+        assert_int_equal(alloc1->mem[i], 0);
+        i += 1;
+    }
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 2000, 1, 1);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+}
+
+static void test_pool_size_classes(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Size classes:
+     *
+     * 1. With the default table, 100 is rounded up to 112, 1 to 8
+     *    and 200 to 224.
+     * 2. Free the 112 and ask for 90: it takes the freed block
+     *    whole, since the 16-byte remainder is under min_gap.
+     * 3. Without a table, sizes are exact again.
+     */
+
+    assert_int_equal(mem_pool_set_size_classes(pool, NULL, 0, 32), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc0->size, 112);
+    assert_int_equal(alloc1->size, 8);
+    assert_int_equal(alloc2->size, 224);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    alloc0 = mem_new_alloc(pool, 90);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 112);
+
+    pool_segment_t exp0[4] =
+            {
+                    {112, 1},
+                    {8, 1},
+                    {224, 1},
+                    {pool->total_size - 344, 0},
+            };
+    check_pool(pool, exp0);
+
+    const size_t none[1] = {0};
+    assert_int_equal(mem_pool_set_size_classes(pool, none, 0, 0), ALLOC_OK);
+    alloc_pt alloc3 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc3);
+    assert_int_equal(alloc3->size, 100);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+}
+
+static void test_pool_deferred(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Deferred coalescing:
+     *
+     * 1. Allocate 100, 200, 300. Free the 100 and the 200: they
+     *    are held back, not merged.
+     * 2. Ask for 200: the freed 200 is handed back (a hit).
+     * 3. Ask for 50: a miss, the held 100 is coalesced first and
+     *    the 50 is carved from it. The first three requests were
+     *    misses too, there was nothing held back yet.
+     */
+
+    assert_int_equal(mem_pool_set_deferred_coalescing(pool, 4), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_NOT_FREED);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 300, 1, 1);
+
+    pool_stats_t stats;
+    assert_int_equal(mem_pool_get_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.quick_count, 2);
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 200);
+    assert_ptr_equal(alloc3, alloc1);
+    alloc_pt alloc4 = mem_new_alloc(pool, 50);
+    assert_ptr_equal(alloc4, alloc0);
+
+    pool_segment_t exp0[5] =
+            {
+                    {50, 1},
+                    {50, 0},
+                    {200, 1},
+                    {300, 1},
+                    {pool->total_size - 600, 0},
+            };
+    check_pool(pool, exp0);
+
+    assert_int_equal(mem_pool_get_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.quick_hits, 1);
+    assert_int_equal(stats.quick_misses, 4);
+    assert_int_equal(stats.sweeps, 1);
+    assert_int_equal(stats.quick_count, 0);
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_pool_set_deferred_coalescing(pool, 0), ALLOC_OK);
+}
+
+static void test_pool_worst_good_fit(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Worst fit and good fit, in a 1000-byte pool:
+     *
+     * 1. Allocate 100, 50, 500, 300 and free the 100 and the 500,
+     *    leaving gaps of 100, 500 and 50 (at the end).
+     * 2. WORST_FIT puts an 80 in the 500.
+     * 3. GOOD_FIT (25%) puts a 45 in the 50 at the end, skipping
+     *    the 100, and a 300, which no gap fits closely, in the
+     *    best fit, the 500.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_segment_t exp0[6] =
+            {
+                    {100, 0},
+                    {50, 1},
+                    {80, 1},
+                    {420, 0},
+                    {300, 1},
+                    {50, 0},
+            };
+    pool_segment_t exp1[7] =
+            {
+                    {100, 0},
+                    {50, 1},
+                    {300, 1},
+                    {200, 0},
+                    {300, 1},
+                    {45, 1},
+                    {5, 0},
+            };
+    alloc_policy policies[2] = {WORST_FIT, GOOD_FIT};
+    unsigned p = 0;
+    while (p < 2){
+        pool_pt pool = mem_pool_open(1000, policies[p]);
+        assert_non_null(pool);
+        alloc_pt alloc0 = mem_new_alloc(pool, 100);
+        alloc_pt alloc1 = mem_new_alloc(pool, 50);
+        alloc_pt alloc2 = mem_new_alloc(pool, 500);
+        alloc_pt alloc3 = mem_new_alloc(pool, 300);
+        assert_non_null(alloc3);
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+        if (policies[p] == WORST_FIT){
+            alloc2 = mem_new_alloc(pool, 80);
+            assert_non_null(alloc2);
+            check_pool(pool, exp0);
+            check_metadata(pool, WORST_FIT, 1000, 430, 3, 3);
+        }else{
+            alloc0 = mem_new_alloc(pool, 45);
+            alloc2 = mem_new_alloc(pool, 300);
+            assert_non_null(alloc0);
+            assert_non_null(alloc2);
+            check_pool(pool, exp1);
+            assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+        }
+
+        assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+        p += 1;
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_tagged(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Boundary-tag pool:
+     *
+     * Every block carries a 24-byte header and an 8-byte footer and is
+     * rounded up to a multiple of 8. Segment sizes are payload sizes.
+     *
+     * 1. Allocate 100, 200, 300. Free the 200.
+     * 2. Free the 100, it merges with the gap after it.
+     * 3. Free the 300 by address, the pool is a single gap again.
+     */
+
+    const size_t TAGS = 32;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_tagged(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    pool_segment_t exp0[1] =
+            {
+                    {POOL_SIZE - TAGS, 0},
+            };
+    check_pool(pool, exp0);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_in_range(alloc1->size, 200, 200);
+    memset(alloc1->mem, 'x', alloc1->size);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_NOT_FREED);
+    pool_segment_t exp1[4] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {300, 1},
+                    {POOL_SIZE - 104 - 200 - 304 - 4 * TAGS, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 400, 2, 2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    pool_segment_t exp2[3] =
+            {
+                    {104 + 200 + TAGS, 0},
+                    {300, 1},
+                    {POOL_SIZE - 104 - 200 - 304 - 4 * TAGS, 0},
+            };
+    check_pool(pool, exp2);
+
+    assert_int_equal(mem_del_ptr(pool, alloc2->mem), ALLOC_OK);
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_bitmap(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Bitmap pool:
+     *
+     * Requests are rounded up to whole 64-byte granules.
+     *
+     * 1. Allocate 100, 64, 200. Free the 64.
+     * 2. Allocate 10, it takes the 64-byte gap and closes it.
+     * 3. Free everything (the last one by address), the pool is a single gap again.
+     */
+
+    const size_t GRANULE = 64;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    assert_null(mem_pool_open_bitmap(POOL_SIZE, 48, FIRST_FIT));
+    pool_pt pool = mem_pool_open_bitmap(POOL_SIZE, GRANULE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_size_classes(pool, NULL, 0, 0), ALLOC_FAIL);
+
+    pool_segment_t exp0[1] =
+            {
+                    {POOL_SIZE, 0},
+            };
+    check_pool(pool, exp0);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 64);
+    alloc_pt alloc2 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc0->size, 128);
+    assert_ptr_equal(alloc1->mem, alloc0->mem + 128);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_ptr(pool, alloc0->mem + 128), ALLOC_NOT_FREED);
+    pool_segment_t exp1[4] =
+            {
+                    {128, 1},
+                    {64, 0},
+                    {256, 1},
+                    {POOL_SIZE - 128 - 64 - 256, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 384, 2, 2);
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc3);
+    assert_ptr_equal(alloc3->mem, alloc0->mem + 128);
+    pool_segment_t exp2[4] =
+            {
+                    {128, 1},
+                    {64, 1},
+                    {256, 1},
+                    {POOL_SIZE - 128 - 64 - 256, 0},
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 448, 3, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_ptr(pool, alloc2->mem), ALLOC_OK);
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_open_ex(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Configured pool:
+     *
+     * 1. A config that could never grow is refused.
+     * 2. Start with room for 4 nodes and 2 gaps, growing 3x when full.
+     * 3. Allocate 100 blocks, then free every other one: the node heap and
+     *    the gap index grow many times, and the alloc_pt handed out first
+     *    still holds the same record.
+     * 4. Free the rest, the pool is a single gap again.
+     */
+
+    const unsigned NUM_ALLOCS = 100;
+    const size_t ALLOC_SIZE = 10;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    mem_pool_config_t stuck = {4, 0.75f, 1, 0, 0, 0, 0, NUMA_DEFAULT, 0};
+    assert_null(mem_pool_open_ex(POOL_SIZE, FIRST_FIT, &stuck));
+
+    mem_pool_config_t config = {4, 1.0f, 3, 2, 1.0f, 3, 0, NUMA_DEFAULT, 0};
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, BEST_FIT, &config);
+    assert_non_null(pool);
+
+    alloc_pt allocs[100];
+    unsigned i = 0;
+    while (i < NUM_ALLOCS){
+        allocs[i] = mem_new_alloc(pool, ALLOC_SIZE);
+        assert_non_null(allocs[i]);
+        memset(allocs[i]->mem, (int) i, ALLOC_SIZE);
+        i += 1;
+    }
+    check_metadata(pool, BEST_FIT, POOL_SIZE, NUM_ALLOCS * ALLOC_SIZE, NUM_ALLOCS, 1);
+
+    i = 1;
+    while (i < NUM_ALLOCS){
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        i += 2;
+    }
+    check_metadata(pool, BEST_FIT, POOL_SIZE, NUM_ALLOCS / 2 * ALLOC_SIZE, NUM_ALLOCS / 2, NUM_ALLOCS / 2);
+    assert_ptr_equal(allocs[0]->mem, pool->mem);
+    assert_int_equal(allocs[0]->size, ALLOC_SIZE);
+    assert_int_equal(allocs[98]->mem[0], 98);
+
+    i = 0;
+    while (i < NUM_ALLOCS){
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        i += 2;
+    }
+    pool_segment_t exp0[1] =
+            {
+                    {POOL_SIZE, 0},
+            };
+    check_pool(pool, exp0);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_prefault(void **state) {
+    const size_t POOL_SIZE = 1 << 20;
+    const size_t ALLOC_SIZE = 4096;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    mem_pool_config_t config = {0, 0, 0, 0, 0, 0, 1, NUMA_DEFAULT, 0};
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, &config);
+    assert_non_null(pool);
+
+    // pre-faulting leaves the pool zeroed
+    alloc_pt alloc0 = mem_new_alloc_zeroed(pool, ALLOC_SIZE);
+    assert_non_null(alloc0);
+    size_t i = 0;
+    while (i < ALLOC_SIZE){
+        assert_int_equal(alloc0->mem[i], 0);
+        i += 1;
+    }
+    assert_int_equal(pool->mem[POOL_SIZE - 1], 0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, ALLOC_SIZE, 1, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_numa(void **state) {
+    const size_t POOL_SIZE = 1 << 20;
+    const size_t ALLOC_SIZE = 100;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // node 0 exists everywhere, and placement is a no-op on a single node
+    mem_pool_config_t bind = {0, 0, 0, 0, 0, 0, 0, NUMA_BIND, 0};
+    pool_pt pool0 = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, &bind);
+    assert_non_null(pool0);
+    // a node that isn't online can't be bound to
+    mem_pool_config_t offline = {0, 0, 0, 0, 0, 0, 0, NUMA_BIND, 4095};
+    assert_null(mem_pool_open_ex(POOL_SIZE, FIRST_FIT, &offline));
+    mem_pool_config_t interleave = {0, 0, 0, 0, 0, 0, 1, NUMA_INTERLEAVE, 0};
+    pool_pt pool1 = mem_pool_open_ex(POOL_SIZE, BEST_FIT, &interleave);
+    assert_non_null(pool1);
+    alloc_pt alloc0 = mem_new_alloc(pool1, ALLOC_SIZE);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, pool1->mem);
+    assert_int_equal(mem_del_alloc(pool1, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool0), ALLOC_OK);
+
+    numa_group_pt group = mem_numa_group_open(POOL_SIZE, FIRST_FIT, NULL);
+    assert_non_null(group);
+    pool_pt local = mem_numa_group_local(group);
+    assert_non_null(local);
+    assert_ptr_equal(mem_numa_group_local(group), local);
+    alloc_pt alloc1 = mem_new_alloc(local, ALLOC_SIZE);
+    assert_non_null(alloc1);
+    check_metadata(local, FIRST_FIT, POOL_SIZE, ALLOC_SIZE, 1, 1);
+    assert_int_equal(mem_del_alloc(local, alloc1), ALLOC_OK);
+    assert_int_equal(mem_numa_group_close(group), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_group(void **state) {
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // the default table: a granule pool, a size-class pool and a pool of its own
+    mem_group_pt group = mem_group_open(NULL, 0);
+    assert_non_null(group);
+    alloc_pt small = mem_group_alloc(group, 100);
+    alloc_pt medium = mem_group_alloc(group, 1000);
+    alloc_pt huge = mem_group_alloc(group, 1 << 20);
+    assert_non_null(small);
+    assert_non_null(medium);
+    assert_non_null(huge);
+    assert_int_equal(huge->size, 1 << 20);
+    memset(huge->mem, 0xff, huge->size);
+    assert_int_equal(mem_group_close(group), ALLOC_NOT_FREED);
+    int local = 0;
+    assert_int_equal(mem_group_free(group, &local), ALLOC_NOT_FREED);
+    // a pool of another group, or of none, isn't ours to free from
+    mem_group_pt other = mem_group_open(NULL, 0);
+    assert_non_null(other);
+    alloc_pt theirs = mem_group_alloc(other, 100);
+    assert_non_null(theirs);
+    assert_int_equal(mem_group_free(group, theirs->mem), ALLOC_NOT_FREED);
+    assert_int_equal(mem_group_free(other, small->mem), ALLOC_NOT_FREED);
+    assert_int_equal(mem_group_free(other, theirs->mem), ALLOC_OK);
+    assert_int_equal(mem_group_close(other), ALLOC_OK);
+    pool_pt alone = mem_pool_open(1000, FIRST_FIT);
+    assert_non_null(alone);
+    alloc_pt direct = mem_new_alloc(alone, 100);
+    assert_non_null(direct);
+    assert_int_equal(mem_group_free(group, direct->mem), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(alone, direct), ALLOC_OK);
+    assert_int_equal(mem_pool_close(alone), ALLOC_OK);
+    assert_int_equal(mem_group_free(group, huge->mem), ALLOC_OK);
+    assert_int_equal(mem_group_free(group, medium->mem), ALLOC_OK);
+    assert_int_equal(mem_group_free(group, small->mem), ALLOC_OK);
+    assert_int_equal(mem_group_close(group), ALLOC_OK);
+
+    // a full pool makes room for another of its class
+    mem_group_class_t bad[2] = {{64, 256, 16, FIRST_FIT}, {64, 1024, 0, BEST_FIT}};
+    assert_null(mem_group_open(bad, 2));
+    mem_group_class_t classes[1] = {{64, 256, 64, FIRST_FIT}};
+    group = mem_group_open(classes, 1);
+    assert_non_null(group);
+    alloc_pt allocs[9];
+    unsigned i = 0;
+    while (i < 9){
+        allocs[i] = mem_group_alloc(group, 64);
+        assert_non_null(allocs[i]);
+        memset(allocs[i]->mem, (int) i, 64);
+        i += 1;
+    }
+    assert_int_equal(allocs[8]->mem[63], 8);
+    i = 0;
+    while (i < 9){
+        assert_int_equal(mem_group_free(group, allocs[i]->mem), ALLOC_OK);
+        i += 1;
+    }
+    assert_int_equal(mem_group_close(group), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_of(void **state) {
+    const size_t POOL_SIZE = 4096;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pools[4];
+    pools[0] = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    pools[1] = mem_pool_open_tagged(POOL_SIZE, BEST_FIT);
+    pools[2] = mem_pool_open_bitmap(POOL_SIZE, 64, FIRST_FIT);
+    pools[3] = mem_pool_open(POOL_SIZE, BEST_FIT);
+    alloc_pt allocs[4];
+    unsigned i = 0;
+    while (i < 4){
+        assert_non_null(pools[i]);
+        allocs[i] = mem_new_alloc(pools[i], 100);
+        assert_non_null(allocs[i]);
+        i += 1;
+    }
+    i = 0;
+    while (i < 4){
+        assert_ptr_equal(mem_pool_of(allocs[i]->mem), pools[i]);
+        assert_ptr_equal(mem_pool_of(allocs[i]->mem + 50), pools[i]);
+        assert_ptr_equal(mem_pool_of(pools[i]->mem + POOL_SIZE - 1), pools[i]);
+        i += 1;
+    }
+    int local = 0;
+    assert_null(mem_pool_of(&local));
+    assert_null(mem_pool_of(NULL));
+
+    assert_int_equal(mem_del_alloc(pools[0], allocs[0]), ALLOC_OK);
+    char *mem0 = pools[0]->mem;
+    assert_int_equal(mem_pool_close(pools[0]), ALLOC_OK);
+    assert_null(mem_pool_of(mem0));
+    assert_ptr_equal(mem_pool_of(allocs[3]->mem), pools[3]);
+    i = 1;
+    while (i < 4){
+        assert_int_equal(mem_del_alloc(pools[i], allocs[i]), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pools[i]), ALLOC_OK);
+        i += 1;
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_lazy_gap_ix(void **state) {
+    const size_t POOL_SIZE = 1000;
+    const size_t ALLOC_SIZE = 100;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    alloc_pt allocs[10];
+    unsigned i = 0;
+    while (i < 10){
+        allocs[i] = mem_new_alloc(pool, ALLOC_SIZE);
+        assert_non_null(allocs[i]);
+        i += 1;
+    }
+    char *mem1 = allocs[1]->mem, *mem3 = allocs[3]->mem;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 6 * ALLOC_SIZE, 6, 3);
+
+    // FIRST_FIT only counted the gaps, BEST_FIT has the index rebuilt
+    pool->policy = BEST_FIT;
+    alloc_pt alloc0 = mem_new_alloc(pool, 150);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, mem3);
+    alloc_pt alloc1 = mem_new_alloc(pool, 90);
+    assert_non_null(alloc1);
+    assert_ptr_equal(alloc1->mem, mem1);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 6 * ALLOC_SIZE + 240, 8, 3);
+
+    pool->policy = FIRST_FIT;
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    i = 0;
+    while (i < 10){
+        if (i != 1 && i != 3 && i != 4 && i != 6){
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        }
+        i += 1;
+    }
+    pool->policy = BEST_FIT;
+    alloc0 = mem_new_alloc(pool, POOL_SIZE);
+    assert_non_null(alloc0);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_gap_scan(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * BEST_FIT search over a long gap index:
+     *
+     * 1. Open 96 gaps of 8 to 384 bytes, each size twice, between 8-byte
+     *    allocations, plus the rest of the pool. The binary search leaves a
+     *    full window to the scan kernel, so the vector loops run.
+     * 2. For every request size up to past the largest gap, the allocation
+     *    lands where a plain scan of the segments says.
+     * 3. Free everything, the pool is a single gap again.
+     */
+
+    const unsigned NUM_GAPS = 96;
+    const size_t SEPARATOR = 8;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+
+    alloc_pt gaps[96], seps[96];
+    size_t used = 0;
+    unsigned i = 0;
+    while (i < NUM_GAPS) {
+        gaps[i] = mem_new_alloc(pool, 8 * (1 + (i * 37) % (NUM_GAPS / 2)));
+        seps[i] = mem_new_alloc(pool, SEPARATOR);
+        assert_non_null(gaps[i]);
+        assert_non_null(seps[i]);
+        used += gaps[i]->size + SEPARATOR;
+        i += 1;
+    }
+    i = 0;
+    while (i < NUM_GAPS) {
+        assert_int_equal(mem_del_alloc(pool, gaps[i]), ALLOC_OK);
+        i += 1;
+    }
+    check_metadata(pool, BEST_FIT, POOL_SIZE, NUM_GAPS * SEPARATOR, NUM_GAPS, NUM_GAPS + 1);
+
+    size_t size = 1;
+    while (size <= 8 * (NUM_GAPS / 2) + 1) {
+        check_best_fit(pool, size);
+        size += 1;
+    }
+    check_best_fit(pool, POOL_SIZE - used);
+    check_best_fit(pool, POOL_SIZE - used + 1);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, NUM_GAPS * SEPARATOR, NUM_GAPS, NUM_GAPS + 1);
+
+    i = 0;
+    while (i < NUM_GAPS) {
+        assert_int_equal(mem_del_alloc(pool, seps[i]), ALLOC_OK);
+        i += 1;
+    }
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_gap_ix_order(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Gap index kept sorted by size, then address:
+     *
+     * 1. Fill a 790-byte pool exactly: 100, 100, 100, 50 and 400 bytes,
+     *    each followed by an 8-byte separator.
+     * 2. Free the 100 at 216, the 400, the 100 at 108, the 50, then the
+     *    100 at 0: entries go in at the end, at the front, and before and
+     *    after others of equal size. BEST_FIT takes the lowest address
+     *    of equal gaps for every request size.
+     * 3. Allocate them back: entries leave from the front, the end and
+     *    the head of the run of 100s.
+     * 4. Free the 100s again, then the separator between the last two, which
+     *    merges them and drops two equal entries from the middle and the end.
+     * 5. Free the rest, the pool is a single gap again.
+     */
+
+    const size_t SIZES[10] = {100, 8, 100, 8, 100, 8, 50, 8, 400, 8};
+    const size_t POOL = 790;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL, BEST_FIT);
+    assert_non_null(pool);
+
+    alloc_pt allocs[10];
+    char *mem[10];
+    unsigned i = 0;
+    while (i < 10) {
+        allocs[i] = mem_new_alloc(pool, SIZES[i]);
+        assert_non_null(allocs[i]);
+        mem[i] = allocs[i]->mem;
+        i += 1;
+    }
+    check_metadata(pool, BEST_FIT, POOL, POOL, 10, 0);
+
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    check_metadata(pool, BEST_FIT, POOL, 5 * 8, 5, 5);
+    size_t size = 1;
+    while (size <= 401) {
+        check_best_fit(pool, size);
+        size += 1;
+    }
+
+    allocs[6] = mem_new_alloc(pool, 50);
+    assert_non_null(allocs[6]);
+    assert_ptr_equal(allocs[6]->mem, mem[6]);
+    allocs[8] = mem_new_alloc(pool, 400);
+    assert_non_null(allocs[8]);
+    assert_ptr_equal(allocs[8]->mem, mem[8]);
+    i = 0;
+    while (i < 6) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+        assert_ptr_equal(allocs[i]->mem, mem[i]);
+        i += 2;
+    }
+    check_metadata(pool, BEST_FIT, POOL, POOL, 10, 0);
+
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK);
+    check_metadata(pool, BEST_FIT, POOL, 50 + 400 + 4 * 8, 6, 2);
+    size = 1;
+    while (size <= 209) {
+        check_best_fit(pool, size);
+        size += 1;
+    }
+
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[9]), ALLOC_OK);
+    check_metadata(pool, BEST_FIT, POOL, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_gap_window(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Binary search handing a window to the scan kernel mid-run:
+     *
+     * For runs of 32-, 64- and 128-byte gaps of several lengths (100 gaps in
+     * all, between 8-byte allocations, freed in scrambled order):
+     * 1. The search for 33 to 64 and for 65 to 128 bytes stops with a window
+     *    edge inside the run of 64s. Every request size still lands in the
+     *    lowest addressed gap of the smallest fitting size.
+     * 2. Free everything, the pool is a single gap again.
+     */
+
+    const unsigned RUNS[3][3] = {{20, 60, 20}, {31, 40, 29}, {1, 96, 3}};
+    const unsigned NUM_GAPS = 100;
+    const size_t SEPARATOR = 8;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    unsigned r = 0;
+    while (r < 3) {
+        pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+        assert_non_null(pool);
+
+        alloc_pt gaps[100], seps[100];
+        unsigned i = 0;
+        while (i < NUM_GAPS) {
+            unsigned slot = (i * 37) % NUM_GAPS;
+            size_t size = (slot < RUNS[r][0]) ? 32 : (slot < RUNS[r][0] + RUNS[r][1]) ? 64 : 128;
+            gaps[i] = mem_new_alloc(pool, size);
+            seps[i] = mem_new_alloc(pool, SEPARATOR);
+            assert_non_null(gaps[i]);
+            assert_non_null(seps[i]);
+            i += 1;
+        }
+        i = 0;
+        while (i < NUM_GAPS) {
+            assert_int_equal(mem_del_alloc(pool, gaps[(i * 61) % NUM_GAPS]), ALLOC_OK);
+            i += 1;
+        }
+        check_metadata(pool, BEST_FIT, POOL_SIZE, NUM_GAPS * SEPARATOR, NUM_GAPS, NUM_GAPS + 1);
+
+        size_t size = 1;
+        while (size <= 129) {
+            check_best_fit(pool, size);
+            size += 1;
+        }
+
+        i = 0;
+        while (i < NUM_GAPS) {
+            assert_int_equal(mem_del_alloc(pool, seps[i]), ALLOC_OK);
+            i += 1;
+        }
+        check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 1);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+        r += 1;
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***          6. STRESS TEST             ***/
+/***                                     ***/
+/***         [non-functional]            ***/
+/***         [see NOTE below]            ***/
+/*******************************************/
+
+void test_pool_stresstest(void **state) {
+    (void) state; /* unused */
+
+    const unsigned num_pools = 200;
+    const unsigned num_allocations = 1000;
+    const unsigned min_alloc_size = 10;
+    const unsigned pool_size =
+            (num_allocations / 2) *
+            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
+    assert_int_equal(pool_size, 5005000);
+
+
+    pool_pt pools[num_pools];
+    alloc_pt allocations[num_pools][num_allocations];
+
+    /*
+     * NOTE: This will work iff the address of the allocation
+     * in the pool is returned to the user instead of the
+     * address of the allocation record. Since allocation records
+     * are a part of the nodes, when the node heap is reallocated
+     * the node addresses shift with it, and so do the allocation
+     * record addresses. The allocation addresses on the pool
+     * remain the same, however, so they can be returned to the
+     * user and gotten from the user upon request for deletion.
+     */
+
+    /*
+     * Testing dynamic reallocation of pool structures:
+     *
+     * 1. 200 pools of 5005000 each (many pools)
+     * 2. In each pool 1000 allocations of different sizes (many allocations)
+     * 3. In each pool 500 deallocations (many gaps)
+     */
+
+    // initialize store
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    // allocate pools
+    for (unsigned pix=0; pix < num_pools; ++pix) {
+        // open pool
+        pools[pix] =
+                mem_pool_open(pool_size, (pix % 2) ? FIRST_FIT : BEST_FIT);
+        assert_non_null(pools[pix]);
+        // allocate pool
+        unsigned allocated = 0;
+        for (unsigned aix=0; aix < num_allocations; ++aix) {
+            allocations[pix][aix] =
+                    mem_new_alloc(pools[pix], (aix + 1) * min_alloc_size);
+            allocated += (aix + 1) * min_alloc_size;
+            if (!allocations[pix][aix]) {
+                INFO("ASSERT WILL FAIL at pix = %u, aix = %u, allocated = %u\n", pix, aix, allocated);
+            }
+            assert_non_null(allocations[pix][aix]);
+        }
+        // delete every other allocation
+        for (unsigned aix=0; aix < num_allocations; ++aix) {
+            if (aix % 2) {
+                assert_int_equal(
+                        mem_del_alloc(pools[pix], allocations[pix][aix]),
+                        ALLOC_OK);
+                allocations[pix][aix] = NULL;
+            }
+        }
+    }
+
+    // delete pools
+    for (unsigned pix=0; pix < num_pools; ++pix) {
+        // delete pool's allocations
+        for (unsigned aix=0; aix < num_allocations; ++aix) {
+            if (allocations[pix][aix]) {
+                // delete allocation
+                assert_int_equal(
+                    mem_del_alloc(pools[pix], allocations[pix][aix]),
+                    ALLOC_OK);
+            }
+        }
+        // close pool
+        assert_int_equal(mem_pool_close(pools[pix]), ALLOC_OK);
+    }
+
+    // free store
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+/*******************************************/
+/***         7. DRIVER ROUTINE           ***/
+/*******************************************/
+
+int run_test_suite() {
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test(test_pool_store_smoketest),
+            cmocka_unit_test(test_pool_store_reinit),
+            cmocka_unit_test(test_pool_smoketest),
+
+            cmocka_unit_test(test_pool_nonempty),
+
+            cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario00, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario01, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario02, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario03, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario04, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario05, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario06, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario07, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario08, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario09, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario10, pool_ff_setup, pool_ff_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario11, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario12, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario13, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario14, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario15, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario16, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario17, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_compact, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_file),
+            cmocka_unit_test(test_pool_file_reopen),
+            cmocka_unit_test(test_pool_shared),
+            cmocka_unit_test(test_pool_shared_open_race),
+            cmocka_unit_test(test_pool_shared_address_taken),
+            cmocka_unit_test_setup_teardown(test_pool_snapshot, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_del_ptr, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_tagged),
+            cmocka_unit_test_setup_teardown(test_pool_zeroed, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_size_classes, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_deferred, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_worst_good_fit),
+            cmocka_unit_test(test_pool_bitmap),
+            cmocka_unit_test(test_pool_open_ex),
+            cmocka_unit_test(test_pool_prefault),
+            cmocka_unit_test(test_pool_numa),
+            cmocka_unit_test(test_pool_group),
+            cmocka_unit_test(test_pool_of),
+            cmocka_unit_test(test_pool_lazy_gap_ix),
+            cmocka_unit_test(test_pool_gap_scan),
+            cmocka_unit_test(test_pool_gap_ix_order),
+            cmocka_unit_test(test_pool_gap_window),
 
             // do not uncomment until the project is changed to return the allocation address
 //            cmocka_unit_test(test_pool_stresstest),